@@ -1,7 +1,11 @@
 #ifndef MC_H
 #define MC_H
 
+#include <atomic>
+#include <cstdio>
 #include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 #include <cmath>
 
@@ -57,6 +61,154 @@ namespace MC
         return size.x() * size.y() * (k % 2) + j * size.x() + i;
     }
 
+    /*!
+      \brief Receives the surface from the streaming march_cubes one z-layer at a
+      time, vertices before the triangles that use them.
+      */
+    class MeshSink {
+    public:
+        virtual ~MeshSink() {}
+
+        // Vertices, numbered on from the ones passed before
+        virtual void addVertices(const std::vector<VEC3F>& vertices) = 0;
+
+        // Triangles, as index triples into all the vertices passed so far
+        virtual void addTriangles(const std::vector<uint>& indices) = 0;
+
+        // Called once the whole surface has been passed
+        virtual void finish() {}
+    };
+
+    /*!
+      \brief Writes the surface to an OBJ file as it comes in. Vertex and face
+      lines are interleaved, which OBJ allows since faces only refer back.
+      */
+    class OBJStreamWriter: public MeshSink {
+    private:
+        std::string filename;
+        FILE* file;
+        size_t numVertices = 0;
+        size_t numFaces = 0;
+
+    public:
+        OBJStreamWriter(std::string filename): filename(filename) {
+            file = fopen(filename.c_str(), "w");
+            if (file == NULL) {
+                PRINTFn("Failed to open %s for writing", filename.c_str());
+                exit(1);
+            }
+            fprintf(file, "g Obj\n");
+        }
+
+        ~OBJStreamWriter() {
+            if (file) fclose(file);
+        }
+
+        void addVertices(const std::vector<VEC3F>& vertices) override {
+            for (const VEC3F& v : vertices)
+                fprintf(file, "v %g %g %g\n", v.x(), v.y(), v.z());
+            numVertices += vertices.size();
+        }
+
+        void addTriangles(const std::vector<uint>& indices) override {
+            for (size_t i = 0; i < indices.size(); i += 3) {
+                uint a = indices[i] + 1, b = indices[i + 1] + 1, c = indices[i + 2] + 1;
+                fprintf(file, "f %u//%u %u//%u %u//%u\n", a, a, b, b, c, c);
+            }
+            numFaces += indices.size() / 3;
+        }
+
+        void finish() override {
+            fclose(file);
+            file = NULL;
+            printf("Wrote %zu vertices and %zu faces to %s\n", numVertices, numFaces, filename.c_str());
+        }
+    };
+
+    /*!
+      \brief Writes the surface to a binary PLY file as it comes in. PLY needs
+      all vertices before the faces, so faces are spooled to a temporary file
+      and appended at the end; the element counts in the header are written
+      as fixed-width placeholders and filled in then.
+      */
+    class PLYStreamWriter: public MeshSink {
+    private:
+        std::string filename;
+        FILE* file;
+        FILE* faceFile;
+        long vertexCountPos, faceCountPos;
+        size_t numVertices = 0;
+        size_t numFaces = 0;
+
+        #pragma pack(push, 1)
+        struct Face {
+            unsigned char n;
+            int32_t v[3];
+        };
+        #pragma pack(pop)
+
+    public:
+        PLYStreamWriter(std::string filename): filename(filename) {
+            file = fopen(filename.c_str(), "wb");
+            faceFile = tmpfile();
+            if (file == NULL || faceFile == NULL) {
+                PRINTFn("Failed to open %s for writing", filename.c_str());
+                exit(1);
+            }
+
+            fprintf(file, "ply\nformat binary_little_endian 1.0\nelement vertex ");
+            vertexCountPos = ftell(file);
+            fprintf(file, "%010zu\n", (size_t) 0);
+            fprintf(file, "property double x\nproperty double y\nproperty double z\nelement face ");
+            faceCountPos = ftell(file);
+            fprintf(file, "%010zu\n", (size_t) 0);
+            fprintf(file, "property list uchar int vertex_indices\nend_header\n");
+        }
+
+        ~PLYStreamWriter() {
+            if (file) fclose(file);
+            if (faceFile) fclose(faceFile);
+        }
+
+        void addVertices(const std::vector<VEC3F>& vertices) override {
+            for (const VEC3F& v : vertices) {
+                double xyz[3] = { v.x(), v.y(), v.z() };
+                fwrite(xyz, sizeof(double), 3, file);
+            }
+            numVertices += vertices.size();
+        }
+
+        void addTriangles(const std::vector<uint>& indices) override {
+            std::vector<Face> faces(indices.size() / 3);
+            for (size_t f = 0; f < faces.size(); f++) {
+                faces[f].n = 3;
+                for (int k = 0; k < 3; k++) faces[f].v[k] = indices[3 * f + k];
+            }
+            fwrite(faces.data(), sizeof(Face), faces.size(), faceFile);
+            numFaces += faces.size();
+        }
+
+        void finish() override {
+            // Append the spooled faces
+            std::vector<char> buffer(1 << 20);
+            rewind(faceFile);
+            size_t n;
+            while ((n = fread(buffer.data(), 1, buffer.size(), faceFile)) > 0)
+                fwrite(buffer.data(), 1, n, file);
+            fclose(faceFile);
+            faceFile = NULL;
+
+            fseek(file, vertexCountPos, SEEK_SET);
+            fprintf(file, "%010zu", numVertices);
+            fseek(file, faceCountPos, SEEK_SET);
+            fprintf(file, "%010zu", numFaces);
+            fclose(file);
+            file = NULL;
+
+            printf("Wrote %zu vertices and %zu faces to %s\n", numVertices, numFaces, filename.c_str());
+        }
+    };
+
     // Look-up table for triangle configurations
     static const unsigned long long mc_internalMarching_cube_tris[256] =
     {
@@ -126,16 +278,113 @@ namespace MC
         143955266ULL, 2385ULL, 18433ULL, 0ULL,
     };
 
+    // Grid access for the templated kernels below. GridT only has to provide
+    // xRes/yRes/zRes and get(x, y, z); the rest of the Grid3D interface is
+    // used when GridT has it.
+    template <typename GridT>
+    static inline void mc_internalGetRow(const GridT* grid, uint y, uint z, uint x0, uint x1, Real* out)
+    {
+        if constexpr (requires { grid->getRow(y, z, x0, x1, out); }) {
+            grid->getRow(y, z, x0, x1, out);
+        } else {
+            for (uint x = x0; x < x1; x++) out[x - x0] = grid->get(x, y, z);
+        }
+    }
+
+    template <typename GridT>
+    static inline void mc_internalGetSlice(const GridT* grid, uint z, Real* out)
+    {
+        if constexpr (requires { grid->getSlice(z, out); }) {
+            grid->getSlice(z, out);
+        } else {
+            for (uint y = 0; y < grid->yRes; y++) mc_internalGetRow(grid, y, z, 0, grid->xRes, out + y * grid->xRes);
+        }
+    }
+
+    template <typename GridT>
+    static inline int mc_internalBrickSign(const GridT* grid, const VEC3I& lo, const VEC3I& hi)
+    {
+        if constexpr (requires { grid->brickSign(lo, hi); }) {
+            return grid->brickSign(lo, hi);
+        } else {
+            return 0;
+        }
+    }
+
+    template <typename GridT>
+    static inline void mc_internalPrepareBrickSigns(GridT* grid)
+    {
+        if constexpr (requires { grid->prepareBrickSigns(); }) {
+            grid->prepareBrickSigns();
+        }
+    }
+
+    // Grids overriding getf(x, y, z) hide the inherited getf(VEC3F), so
+    // accept either form
+    template <typename GridT>
+    concept mc_internalSamplable = requires(const GridT* grid) { grid->getf(Real(), Real(), Real()); } ||
+                                   requires(const GridT* grid) { grid->getf(VEC3F()); };
+
+    template <typename GridT>
+    static inline Real mc_internalGetf(const GridT* grid, const VEC3F& pos)
+    {
+        if constexpr (requires { grid->getf(Real(), Real(), Real()); }) {
+            return grid->getf(pos[0], pos[1], pos[2]);
+        } else {
+            return grid->getf(pos);
+        }
+    }
+
+    template <typename GridT>
+    static inline bool mc_internalSupportsRootFinding(const GridT* grid)
+    {
+        if constexpr (mc_internalSamplable<GridT> && requires { grid->supportsNonIntegerIndices; }) {
+            return grid->supportsNonIntegerIndices;
+        } else {
+            return false;
+        }
+    }
+
+    // Grids that don't say otherwise are only read from one thread
+    template <typename GridT>
+    static inline bool mc_internalSupportsConcurrentReads(const GridT* grid)
+    {
+        if constexpr (requires { grid->supportsConcurrentReads(); }) {
+            return grid->supportsConcurrentReads();
+        } else {
+            return false;
+        }
+    }
+
+    // Marching cube configurations (bit i set when corner i is negative) of
+    // the n cubes along a row, from the four rows of nodes around it.
+    // Branch-free, so the compiler can vectorise it.
+    static inline void mc_internalRowConfigs(const Real* l0, const Real* l1, const Real* u0, const Real* u1, uint n, uint8_t* configs)
+    {
+        for (uint x = 0; x < n; x++) {
+            configs[x] =
+                ((l0[x] < 0) << 0) |
+                ((l0[x + 1] < 0) << 1) |
+                ((l1[x] < 0) << 2) |
+                ((l1[x + 1] < 0) << 3) |
+                ((u0[x] < 0) << 4) |
+                ((u0[x + 1] < 0) << 5) |
+                ((u1[x] < 0) << 6) |
+                ((u1[x + 1] < 0) << 7);
+        }
+    }
+
     /*!
       \brief Approximates the vertex position of the mesh from the scalar values along an edge (va, vb).
       \param slab_inds slab indices global array
-      \param mesh the mesh
+      \param vertices vertex array the new vertex is appended to
       \param va, vb edges values
       \param axis axis index 0/1/2
       \param x, y, z current slab index
       \param size slab indices array size
       */
-    static void mc_internalComputeEdge(VEC3I* slab_inds, MCMesh& mesh, Grid3D* grid, float va, float vb, int axis, uint x, uint y, uint z, const VEC3I& size)
+    template <typename GridT>
+    static void mc_internalComputeEdge(VEC3I* slab_inds, std::vector<VEC3F>& vertices, uint vertexBase, const GridT* grid, bool rootFinding, float va, float vb, int axis, uint x, uint y, uint z, const VEC3I& size)
     {
         if ((va < 0.0) == (vb < 0.0))
             return;
@@ -143,14 +392,15 @@ namespace MC
 
         VEC3F offset(0,0,0);
 
-        if (grid->supportsNonIntegerIndices) { // Do a root-finding pass if we can
+        if constexpr (mc_internalSamplable<GridT>)
+        if (rootFinding) { // Do a root-finding pass if we can
             double l_bound = (va>0)?0:1;
             double r_bound = (va>0)?1:0;
 
             for(int i = 0; i < MC_MAX_ROOTFINDING_ITERATIONS; ++i) {
                 offset[axis] = 0.5 * (l_bound + r_bound);
                 VEC3F samplePoint = VEC3F(x,y,z) + offset;
-                const Real val = grid->getf(samplePoint);
+                const Real val = mc_internalGetf(grid, samplePoint);
 
                 if (fabs(val) < MC_ROOTFINDING_THRESH) break;
 
@@ -166,9 +416,8 @@ namespace MC
 
         VEC3F v = VEC3F(x, y, z) + offset;
         // v[axis] += va / (va - vb);
-        slab_inds[mc_internalToIndex1DSlab(x, y, z, size)][axis] = uint(mesh.vertices.size());
-        mesh.vertices.push_back(v);
-        mesh.normals.push_back(VEC3F(0, 0, 0));
+        slab_inds[mc_internalToIndex1DSlab(x, y, z, size)][axis] = vertexBase + uint(vertices.size());
+        vertices.push_back(v);
     }
 
     /*!
@@ -189,112 +438,236 @@ namespace MC
         mesh.normals[c] += n;
     }
 
-
-    /*
-       \brief Stores the default array sizes for the indexed mesh computed
-       by the marching cubes. Useful for speeding-up the marching cubes.
-       \param vertSize vertex array size
-       \param normSize normal array size
-       \param triSize triangle index array size
-       */
-    inline void setDefaultArraySizes(uint vertSize, uint normSize, uint triSize)
-    {
-        defaultVerticeArraySize		= vertSize;
-        defaultNormalArraySize		= normSize;
-        defaultTriangleArraySize	= triSize;
-    }
+    // Edge length, in cubes, of the bricks checked with Grid3D::brickSign
+    static const uint MC_BRICK_SIZE = 8;
+
+    // Set on indices that refer to a vertex on the bottom plane of a slab,
+    // which belongs to the slab below; the rest of the index is
+    // 2 * (plane cell) + axis
+    static const uint MC_PREV_SLAB_BIT = 0x80000000u;
+
+    // Vertices and triangles of the cubes in one z-range. Vertex indices are
+    // local to the slab; topPlane holds the slab_inds plane of the slab's
+    // last z, so the slab above can resolve its MC_PREV_SLAB_BIT indices.
+    // vertexBase is the index of vertices[0], nonzero once earlier layers
+    // have been streamed out and cleared.
+    struct SlabOutput {
+        uint vertexBase = 0;
+        std::vector<VEC3F> vertices;
+        std::vector<uint> indices;
+        std::vector<VEC3I> topPlane;
+    };
 
     /*!
-      \brief Computes the mesh representing the zero isosurface of a 3D scalar field and
-      outputs it to an indexed mesh.
-      \param grid Grid3D scalar field or function of real values
-      \param outputMesh indexed mesh returned.
-      \param verbose if true, prints progress updates
+      \brief Marches the cubes with z0 <= z < z1. Each edge vertex is created by
+      the same cube as in a single pass over the whole grid, so concatenating
+      the slabs in order reproduces the serial vertex order. onLayer(z) is
+      called after each z-layer; it may pass the layer's output on and clear
+      it, advancing out.vertexBase by the number of vertices removed.
       */
-    inline void march_cubes(Grid3D *grid, MCMesh& outputMesh, bool verbose = false) {
-
+    template <typename GridT, typename OnLayer>
+    static void mc_internalMarchSlab(const GridT* grid, uint z0, uint z1, SlabOutput& out, OnLayer onLayer)
+    {
         uint nx = grid->xRes;
         uint ny = grid->yRes;
         uint nz = grid->zRes;
 
-        outputMesh.vertices.reserve(defaultVerticeArraySize);
-        outputMesh.normals.reserve(defaultNormalArraySize);
-        outputMesh.indices.reserve(defaultTriangleArraySize);
-
-        PB_START("Marching cubes with res %dx%dx%d", nx, ny, nz);
-        PB_PROGRESS(0);
+        const VEC3I size(nx, ny, nz);
 
         VEC3I* slab_inds = new VEC3I[nx * ny * 2];
         for (uint i = 0; i < nx*ny*2; ++i) {
             slab_inds[i] = VEC3I(0,0,0);
         }
 
-        for (uint z = 0; z < nz - 1; z++)
-        {
-            const VEC3I size(nx, ny, nz);
+        std::vector<VEC3F>& vertices = out.vertices;
+        const bool rootFinding = mc_internalSupportsRootFinding(grid);
+
+        // Grids with contiguous storage are read in place
+        constexpr bool direct = requires { grid->data(); };
+
+        // Bricks of cubes whose nodes all have the same sign can't contain
+        // any surface. Their nodes aren't sampled; they're filled with that
+        // sign instead, so the cubes fall out as configuration 0 or 255.
+        // Direct grids cost nothing to read, so for them the bricks only
+        // skip cubes.
+        const uint B   = MC_BRICK_SIZE;
+        const uint nbx = (nx - 2) / B + 1;
+        const uint nby = (ny - 2) / B + 1;
+        const uint bz0 = z0 / B;
+        const uint nbz = (z1 - 1) / B - bz0 + 1;
+
+        std::vector<signed char> brickSigns(nbx * nby * nbz);
+        bool anyUniform = false;
+        for (uint bz = 0; bz < nbz; bz++) {
+            for (uint by = 0; by < nby; by++) {
+                for (uint bx = 0; bx < nbx; bx++) {
+                    VEC3I lo(bx * B, by * B, (bz0 + bz) * B);
+                    VEC3I hi(std::min(lo[0] + B, nx - 1), std::min(lo[1] + B, ny - 1), std::min(lo[2] + B, nz - 1));
+                    int sign = mc_internalBrickSign(grid, lo, hi);
+                    brickSigns[(bz * nby + by) * nbx + bx] = sign;
+                    anyUniform |= (sign != 0);
+                }
+            }
+        }
+
+        auto brickSign = [&](uint cx, uint cy, uint cz) -> int {
+            return brickSigns[((cz / B - bz0) * nby + cy / B) * nbx + cx / B];
+        };
+
+        // Combines two brick signs: uniform only if both are uniform
+        auto combine = [](int a, int b) {
+            return (a == 0 || b == 0) ? 0 : a;
+        };
+
+        // Reads plane p, which the cube layers p - 1 and p (those within
+        // the slab) touch, into out, or returns it in place for direct
+        // grids. A node is sampled unless every cube around it is in a
+        // uniform brick.
+        std::vector<signed char> rowSigns(nbx);
+        auto readPlane = [&](uint p, Real* out) -> const Real* {
+            if constexpr (direct) {
+                return grid->data() + (size_t) p * nx * ny;
+            }
+
+            if (!anyUniform) {
+                mc_internalGetSlice(grid, p, out);
+                return out;
+            }
+
+            const uint cz0 = (p > z0) ? p - 1 : p;
+            const uint cz1 = std::min(p, z1 - 1);
+
+            for (uint y = 0; y < ny; y++) {
+                const uint cy0 = (y > 0) ? y - 1 : 0;
+                const uint cy1 = std::min(y, ny - 2);
+
+                // Sign of each brick column over the cube rows and layers
+                // around this row of nodes
+                for (uint bx = 0; bx < nbx; bx++) {
+                    rowSigns[bx] = combine(
+                        combine(brickSign(bx * B, cy0, cz0), brickSign(bx * B, cy1, cz0)),
+                        combine(brickSign(bx * B, cy0, cz1), brickSign(bx * B, cy1, cz1)));
+                }
+
+                uint runStart = 0;
+                bool inRun = false;
+                for (uint x = 0; x < nx; x++) {
+                    const uint cx0 = (x > 0) ? x - 1 : 0;
+                    const uint cx1 = std::min(x, nx - 2);
+                    const int fill = combine(rowSigns[cx0 / B], rowSigns[cx1 / B]);
+
+                    if (fill == 0) {
+                        if (!inRun) runStart = x;
+                        inRun = true;
+                        continue;
+                    }
+                    if (inRun) {
+                        mc_internalGetRow(grid, y, p, runStart, x, out + y * nx + runStart);
+                        inRun = false;
+                    }
+                    out[y * nx + x] = fill;
+                }
+                if (inRun) {
+                    mc_internalGetRow(grid, y, p, runStart, nx, out + y * nx + runStart);
+                }
+            }
+            return out;
+        };
 
+        // Rolling pair of XY planes of grid values, so every node is
+        // sampled once per slab instead of once per cube touching it
+        std::vector<Real> lowerBuf(direct ? 0 : nx * ny), upperBuf(direct ? 0 : nx * ny);
+        const Real* lower = readPlane(z0, lowerBuf.data());
+        std::vector<uint8_t> configs(nx - 1);
+
+        for (uint z = z0; z < z1; z++)
+        {
             Real vs[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
             uint edge_indices[12];
 
+            const Real* upper = readPlane(z + 1, upperBuf.data());
+
             for (uint y = 0; y < ny - 1; y++)
             {
+                const Real* l0 = &lower[y * nx];
+                const Real* l1 = &lower[(y + 1) * nx];
+                const Real* u0 = &upper[y * nx];
+                const Real* u1 = &upper[(y + 1) * nx];
+
+                // Filled-in planes make uniform bricks classify as 0 or 255
+                // anyway; direct grids classify only the other bricks
+                if (direct && anyUniform) {
+                    for (uint x = 0; x < nx - 1; x += B) {
+                        const uint n = std::min(B, nx - 1 - x);
+                        if (brickSign(x, y, z) == 0) {
+                            mc_internalRowConfigs(l0 + x, l1 + x, u0 + x, u1 + x, n, configs.data() + x);
+                        }
+                    }
+                } else {
+                    mc_internalRowConfigs(l0, l1, u0, u1, nx - 1, configs.data());
+                }
+
                 for (uint x = 0; x < nx - 1; x++)
                 {
+                    if (direct && anyUniform && x % B == 0 && brickSign(x, y, z) != 0) {
+                        x += B - 1;
+                        continue;
+                    }
 
-                    vs[0] = grid->get(x, y, z);
-                    vs[1] = grid->get(x + 1, y, z);
-                    vs[2] = grid->get(x, y + 1, z);
-                    vs[3] = grid->get(x + 1, y + 1, z);
-                    vs[4] = grid->get(x, y, z + 1);
-                    vs[5] = grid->get(x + 1, y, z + 1);
-                    vs[6] = grid->get(x, y + 1, z + 1);
-                    vs[7] = grid->get(x + 1, y + 1, z + 1);
-
-                    const int config_n =
-                        ((vs[0] < 0) << 0) |
-                        ((vs[1] < 0) << 1) |
-                        ((vs[2] < 0) << 2) |
-                        ((vs[3] < 0) << 3) |
-                        ((vs[4] < 0) << 4) |
-                        ((vs[5] < 0) << 5) |
-                        ((vs[6] < 0) << 6) |
-                        ((vs[7] < 0) << 7);
+                    const int config_n = configs[x];
                     if (config_n == 0 || config_n == 255)
                         continue;
 
+                    vs[0] = l0[x];
+                    vs[1] = l0[x + 1];
+                    vs[2] = l1[x];
+                    vs[3] = l1[x + 1];
+                    vs[4] = u0[x];
+                    vs[5] = u0[x + 1];
+                    vs[6] = u1[x];
+                    vs[7] = u1[x + 1];
+
                     if (y == 0 && z == 0)
-                        mc_internalComputeEdge(slab_inds, outputMesh, grid, vs[0], vs[1], 0, x, y, z, size);
+                        mc_internalComputeEdge(slab_inds, vertices, out.vertexBase, grid, rootFinding, vs[0], vs[1], 0, x, y, z, size);
                     if (z == 0)
-                        mc_internalComputeEdge(slab_inds, outputMesh, grid, vs[2], vs[3], 0, x, y + 1, z, size);
+                        mc_internalComputeEdge(slab_inds, vertices, out.vertexBase, grid, rootFinding, vs[2], vs[3], 0, x, y + 1, z, size);
                     if (y == 0)
-                        mc_internalComputeEdge(slab_inds, outputMesh, grid, vs[4], vs[5], 0, x, y, z + 1, size);
+                        mc_internalComputeEdge(slab_inds, vertices, out.vertexBase, grid, rootFinding, vs[4], vs[5], 0, x, y, z + 1, size);
 
-                    mc_internalComputeEdge(slab_inds, outputMesh, grid, vs[6], vs[7], 0, x, y + 1, z + 1, size);
+                    mc_internalComputeEdge(slab_inds, vertices, out.vertexBase, grid, rootFinding, vs[6], vs[7], 0, x, y + 1, z + 1, size);
 
                     if (x == 0 && z == 0)
-                        mc_internalComputeEdge(slab_inds, outputMesh, grid, vs[0], vs[2], 1, x, y, z, size);
+                        mc_internalComputeEdge(slab_inds, vertices, out.vertexBase, grid, rootFinding, vs[0], vs[2], 1, x, y, z, size);
                     if (z == 0)
-                        mc_internalComputeEdge(slab_inds, outputMesh, grid, vs[1], vs[3], 1,x + 1, y, z, size);
+                        mc_internalComputeEdge(slab_inds, vertices, out.vertexBase, grid, rootFinding, vs[1], vs[3], 1,x + 1, y, z, size);
                     if (x == 0)
-                        mc_internalComputeEdge(slab_inds, outputMesh, grid, vs[4], vs[6], 1, x, y, z + 1, size);
+                        mc_internalComputeEdge(slab_inds, vertices, out.vertexBase, grid, rootFinding, vs[4], vs[6], 1, x, y, z + 1, size);
 
-                    mc_internalComputeEdge(slab_inds, outputMesh, grid, vs[5], vs[7], 1, x + 1, y, z + 1, size);
+                    mc_internalComputeEdge(slab_inds, vertices, out.vertexBase, grid, rootFinding, vs[5], vs[7], 1, x + 1, y, z + 1, size);
 
                     if (x == 0 && y == 0)
-                        mc_internalComputeEdge(slab_inds, outputMesh, grid, vs[0], vs[4], 2, x, y, z, size);
+                        mc_internalComputeEdge(slab_inds, vertices, out.vertexBase, grid, rootFinding, vs[0], vs[4], 2, x, y, z, size);
                     if (y == 0)
-                        mc_internalComputeEdge(slab_inds, outputMesh, grid, vs[1], vs[5], 2, x + 1, y, z, size);
+                        mc_internalComputeEdge(slab_inds, vertices, out.vertexBase, grid, rootFinding, vs[1], vs[5], 2, x + 1, y, z, size);
                     if (x == 0)
-                        mc_internalComputeEdge(slab_inds, outputMesh, grid, vs[2], vs[6], 2, x, y + 1, z, size);
-
-                    mc_internalComputeEdge(slab_inds, outputMesh, grid, vs[3], vs[7], 2, x + 1, y + 1, z, size);
-
-                    edge_indices[0] = slab_inds[mc_internalToIndex1DSlab(x, y, z, size)].x();
-                    edge_indices[1] = slab_inds[mc_internalToIndex1DSlab(x, y + 1, z, size)].x();
+                        mc_internalComputeEdge(slab_inds, vertices, out.vertexBase, grid, rootFinding, vs[2], vs[6], 2, x, y + 1, z, size);
+
+                    mc_internalComputeEdge(slab_inds, vertices, out.vertexBase, grid, rootFinding, vs[3], vs[7], 2, x + 1, y + 1, z, size);
+
+                    if (z == z0 && z0 > 0) {
+                        // Bottom plane edges were created by the slab below
+                        edge_indices[0] = MC_PREV_SLAB_BIT | (mc_internalToIndex1D(x, y, 0, size) * 2 + 0);
+                        edge_indices[1] = MC_PREV_SLAB_BIT | (mc_internalToIndex1D(x, y + 1, 0, size) * 2 + 0);
+                        edge_indices[4] = MC_PREV_SLAB_BIT | (mc_internalToIndex1D(x, y, 0, size) * 2 + 1);
+                        edge_indices[5] = MC_PREV_SLAB_BIT | (mc_internalToIndex1D(x + 1, y, 0, size) * 2 + 1);
+                    } else {
+                        edge_indices[0] = slab_inds[mc_internalToIndex1DSlab(x, y, z, size)].x();
+                        edge_indices[1] = slab_inds[mc_internalToIndex1DSlab(x, y + 1, z, size)].x();
+                        edge_indices[4] = slab_inds[mc_internalToIndex1DSlab(x, y, z, size)].y();
+                        edge_indices[5] = slab_inds[mc_internalToIndex1DSlab(x + 1, y, z, size)].y();
+                    }
                     edge_indices[2] = slab_inds[mc_internalToIndex1DSlab(x, y, z + 1, size)].x();
                     edge_indices[3] = slab_inds[mc_internalToIndex1DSlab(x, y + 1, z + 1, size)].x();
-                    edge_indices[4] = slab_inds[mc_internalToIndex1DSlab(x, y, z, size)].y();
-                    edge_indices[5] = slab_inds[mc_internalToIndex1DSlab(x + 1, y, z, size)].y();
                     edge_indices[6] = slab_inds[mc_internalToIndex1DSlab(x, y, z + 1, size)].y();
                     edge_indices[7] = slab_inds[mc_internalToIndex1DSlab(x + 1, y, z + 1, size)].y();
                     edge_indices[8] = slab_inds[mc_internalToIndex1DSlab(x, y, z, size)].z();
@@ -303,42 +676,275 @@ namespace MC
                     edge_indices[11] = slab_inds[mc_internalToIndex1DSlab(x + 1, y + 1, z, size)].z();
 
                     const uint64_t& config = mc_internalMarching_cube_tris[config_n];
-                    const size_t n_triangles = config & 0xF;
-                    const size_t n_indices = n_triangles * 3;
-                    const size_t& indexBase = outputMesh.indices.size();
+                    const size_t n_indices = (config & 0xF) * 3;
                     int offset = 4;
                     for (size_t i = 0; i < n_indices; i++)
                     {
                         const int edge = (config >> offset) & 0xF;
-                        outputMesh.indices.push_back(edge_indices[edge]);
+                        out.indices.push_back(edge_indices[edge]);
                         offset += 4;
                     }
-                    for (size_t i = 0; i < n_triangles; i++)
-                    {
-                        mc_internalAccumulateNormal(outputMesh,
-                            outputMesh.indices[indexBase + i * 3 + 0],
-                            outputMesh.indices[indexBase + i * 3 + 1],
-                            outputMesh.indices[indexBase + i * 3 + 2]);
-                    }
 
                 }
             }
 
+            // The upper plane becomes the lower one
+            if constexpr (direct) {
+                lower = upper;
+            } else {
+                lowerBuf.swap(upperBuf);
+                lower = lowerBuf.data();
+            }
+
+            onLayer(z);
+        }
+
+        out.topPlane.assign(slab_inds + (z1 % 2) * nx * ny, slab_inds + (z1 % 2 + 1) * nx * ny);
+
+        delete[] slab_inds;
+    }
+
+    // Copies the slabs into the mesh in order, resolving slab-local and
+    // previous-slab indices, then accumulates and normalizes the normals if
+    // the mesh asks for them
+    static void mc_internalStitchSlabs(std::vector<SlabOutput>& slabs, MCMesh& outputMesh)
+    {
+        uint prevBase = 0;
+        for (size_t s = 0; s < slabs.size(); s++) {
+            const uint base = outputMesh.vertices.size();
+
+            // Nothing to resolve in the first slab
+            if (s == 0 && base == 0 && outputMesh.indices.empty()) {
+                outputMesh.vertices.swap(slabs[0].vertices);
+                outputMesh.indices.swap(slabs[0].indices);
+                continue;
+            }
+
+            outputMesh.vertices.insert(outputMesh.vertices.end(), slabs[s].vertices.begin(), slabs[s].vertices.end());
+
+            for (uint idx : slabs[s].indices) {
+                if (idx & MC_PREV_SLAB_BIT) {
+                    uint cell = (idx & ~MC_PREV_SLAB_BIT) / 2;
+                    uint axis = (idx & ~MC_PREV_SLAB_BIT) % 2;
+                    outputMesh.indices.push_back(prevBase + slabs[s - 1].topPlane[cell][axis]);
+                } else {
+                    outputMesh.indices.push_back(base + idx);
+                }
+            }
+
+            // The slab above only needs this slab's top plane
+            if (s > 0) slabs[s - 1] = SlabOutput();
+            prevBase = base;
+        }
+
+        if (!outputMesh.computeNormals) return;
+
+        outputMesh.normals.assign(outputMesh.vertices.size(), VEC3F(0, 0, 0));
+        for (size_t i = 0; i < outputMesh.indices.size(); i += 3)
+        {
+            mc_internalAccumulateNormal(outputMesh,
+                outputMesh.indices[i + 0],
+                outputMesh.indices[i + 1],
+                outputMesh.indices[i + 2]);
+        }
+
+        for (size_t i = 0; i < outputMesh.normals.size(); i++)
+            outputMesh.normals[i] = mc_internalNormalize(outputMesh.normals[i]);
+    }
+
+
+    /*
+       \brief Stores the default array sizes for the indexed mesh computed
+       by the marching cubes. Useful for speeding-up the marching cubes.
+       \param vertSize vertex array size
+       \param normSize normal array size
+       \param triSize triangle index array size
+       */
+    inline void setDefaultArraySizes(uint vertSize, uint normSize, uint triSize)
+    {
+        defaultVerticeArraySize		= vertSize;
+        defaultNormalArraySize		= normSize;
+        defaultTriangleArraySize	= triSize;
+    }
+
+    /*!
+      \brief Computes the mesh representing the zero isosurface of a 3D scalar field and
+      outputs it to an indexed mesh.
+      \param grid Grid3D scalar field or function of real values
+      \param outputMesh indexed mesh returned.
+      \param verbose if true, prints progress updates
+
+      Templated on the grid type, so the hot loop calls the concrete grid
+      directly. GridT can be any Grid3D, or any type with xRes/yRes/zRes and
+      get(x, y, z).
+      */
+    template <typename GridT>
+    void march_cubes(GridT *grid, MCMesh& outputMesh, bool verbose = false) {
+
+        uint nx = grid->xRes;
+        uint ny = grid->yRes;
+        uint nz = grid->zRes;
+
+        outputMesh.vertices.reserve(defaultVerticeArraySize);
+        if (outputMesh.computeNormals) outputMesh.normals.reserve(defaultNormalArraySize);
+        outputMesh.indices.reserve(defaultTriangleArraySize);
+
+        PB_START("Marching cubes with res %dx%dx%d", nx, ny, nz);
+        PB_PROGRESS(0);
+
+        mc_internalPrepareBrickSigns(grid);
+
+        std::vector<SlabOutput> slabs(1);
+        mc_internalMarchSlab(grid, 0, nz - 1, slabs[0], [&](uint z) {
             PB_PROGRESS((float) z / nz);
 
             fflush(stdout);
+        });
+
+        PB_END();
+
+        if (verbose) printf("\n");
+
+        mc_internalStitchSlabs(slabs, outputMesh);
+
+        outputMesh.finalize();
+    }
+
+    /*!
+      \brief Same as march_cubes, but hands the surface to sink one z-layer at a
+      time instead of building a mesh, so memory stays bounded by a few grid
+      planes however large the surface is. Vertices and triangles come out in
+      the same order as in the mesh; no normals are computed.
+      */
+    template <typename GridT>
+    void march_cubes(GridT *grid, MeshSink& sink, bool verbose = false) {
+
+        uint nx = grid->xRes;
+        uint ny = grid->yRes;
+        uint nz = grid->zRes;
+
+        PB_START("Streaming marching cubes with res %dx%dx%d", nx, ny, nz);
+        PB_PROGRESS(0);
+
+        mc_internalPrepareBrickSigns(grid);
+
+        SlabOutput layer;
+        mc_internalMarchSlab(grid, 0, nz - 1, layer, [&](uint z) {
+            sink.addVertices(layer.vertices);
+            sink.addTriangles(layer.indices);
+
+            layer.vertexBase += layer.vertices.size();
+            layer.vertices.clear();
+            layer.indices.clear();
+
+            PB_PROGRESS((float) z / nz);
+
+            fflush(stdout);
+        });
+
+        PB_END();
+
+        if (verbose) printf("\n");
+
+        sink.finish();
+    }
+
+    /*!
+      \brief Same as march_cubes (and with identical output), but splits the grid
+      into z-slabs that are marched on numThreads threads and stitched together
+      afterwards. Falls back to march_cubes for grids that can't be read from
+      several threads at once.
+      \param numThreads worker count, 0 to use every hardware thread
+      */
+    template <typename GridT>
+    void march_cubes_parallel(GridT *grid, MCMesh& outputMesh, bool verbose = false, uint numThreads = 0) {
+        if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+        if (numThreads == 1 || !mc_internalSupportsConcurrentReads(grid)) {
+            march_cubes(grid, outputMesh, verbose);
+            return;
         }
 
-        delete[] slab_inds;
+        uint nx = grid->xRes;
+        uint ny = grid->yRes;
+        uint nz = grid->zRes;
+
+        outputMesh.vertices.reserve(defaultVerticeArraySize);
+        if (outputMesh.computeNormals) outputMesh.normals.reserve(defaultNormalArraySize);
+        outputMesh.indices.reserve(defaultTriangleArraySize);
+
+        // A few slabs per thread, handed out dynamically, to even out load
+        const uint numSlabs = std::min(nz - 1, numThreads * 4);
+        std::vector<SlabOutput> slabs(numSlabs);
+        std::atomic<uint> nextSlab = 0;
+        std::mutex progressMutex;
+        uint slabsDone = 0;
+
+        PB_START("Marching cubes with res %dx%dx%d on %u threads", nx, ny, nz, numThreads);
+        PB_PROGRESS(0);
+
+        mc_internalPrepareBrickSigns(grid);
+
+        std::vector<std::thread> workers;
+        for (uint t = 0; t < numThreads; t++) {
+            workers.emplace_back([&]() {
+                for (uint s = nextSlab++; s < numSlabs; s = nextSlab++) {
+                    uint z0 = (uint64_t) (nz - 1) * s / numSlabs;
+                    uint z1 = (uint64_t) (nz - 1) * (s + 1) / numSlabs;
+                    mc_internalMarchSlab(grid, z0, z1, slabs[s], [](uint) {});
+
+                    std::lock_guard<std::mutex> lock(progressMutex);
+                    slabsDone++;
+                    PB_PROGRESS((float) slabsDone / numSlabs);
+                }
+            });
+        }
+        for (auto& w : workers) w.join();
 
         PB_END();
 
         if (verbose) printf("\n");
 
-        for (size_t i = 0; i < outputMesh.normals.size(); i++)
-            outputMesh.normals[i] = mc_internalNormalize(outputMesh.normals[i]);
+        mc_internalStitchSlabs(slabs, outputMesh);
 
         outputMesh.finalize();
     }
 
+    /*!
+      \brief march_cubes on a grid only known as a Grid3D; dispatches to the
+      instantiation for its concrete type when there is one.
+      */
+    inline void march_cubes(Grid3D *grid, MCMesh& outputMesh, bool verbose = false) {
+        if (ArrayGrid3D* g = dynamic_cast<ArrayGrid3D*>(grid))
+            march_cubes<ArrayGrid3D>(g, outputMesh, verbose);
+        else if (InterpolationGrid* g = dynamic_cast<InterpolationGrid*>(grid))
+            march_cubes<InterpolationGrid>(g, outputMesh, verbose);
+        else
+            march_cubes<Grid3D>(grid, outputMesh, verbose);
+    }
+
+    /*!
+      \brief Streaming march_cubes on a grid only known as a Grid3D
+      */
+    inline void march_cubes(Grid3D *grid, MeshSink& sink, bool verbose = false) {
+        if (ArrayGrid3D* g = dynamic_cast<ArrayGrid3D*>(grid))
+            march_cubes<ArrayGrid3D>(g, sink, verbose);
+        else if (InterpolationGrid* g = dynamic_cast<InterpolationGrid*>(grid))
+            march_cubes<InterpolationGrid>(g, sink, verbose);
+        else
+            march_cubes<Grid3D>(grid, sink, verbose);
+    }
+
+    /*!
+      \brief march_cubes_parallel on a grid only known as a Grid3D
+      */
+    inline void march_cubes_parallel(Grid3D *grid, MCMesh& outputMesh, bool verbose = false, uint numThreads = 0) {
+        if (ArrayGrid3D* g = dynamic_cast<ArrayGrid3D*>(grid))
+            march_cubes_parallel<ArrayGrid3D>(g, outputMesh, verbose, numThreads);
+        else if (InterpolationGrid* g = dynamic_cast<InterpolationGrid*>(grid))
+            march_cubes_parallel<InterpolationGrid>(g, outputMesh, verbose, numThreads);
+        else
+            march_cubes_parallel<Grid3D>(grid, outputMesh, verbose, numThreads);
+    }
+
 }
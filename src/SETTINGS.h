@@ -23,7 +23,12 @@ typedef Matrix<int, 3, 1 > VEC3I;
 typedef Matrix<int, 1, 1 > VEC2I;
 typedef VectorXd VECTOR;
 
+// Root finding places marching cubes vertices on the surface of smooth fields
+// (e.g. VideoTileDenseField's DISTANCE mode); enable it with
+// CPPFLAGS=-DMC_MAX_ROOTFINDING_ITERATIONS=8
+#ifndef MC_MAX_ROOTFINDING_ITERATIONS
 #define MC_MAX_ROOTFINDING_ITERATIONS 0
+#endif
 #define MC_ROOTFINDING_THRESH 1e-8
 
 // DEBUGGING MACROS
@@ -0,0 +1,176 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+
+#include "SETTINGS.h"
+#include "field.h"
+
+using namespace std;
+
+// Dynamic bounding volume hierarchy over AABBs, in the style of Box2D's
+// b2DynamicTree. Leaves carry an integer payload (e.g. an index into a vector
+// of meshes) and can be inserted at any time; internal nodes are refit on the
+// way back up so the tree stays valid after every insertion.
+class DynamicAABBTree {
+private:
+    struct Node {
+        AABB box;
+        int parent = -1;
+        int left   = -1;
+        int right  = -1;
+        int item   = -1;
+
+        bool isLeaf() const { return left == -1; }
+    };
+
+    vector<Node> nodes;
+    int root = -1;
+    size_t numLeaves = 0;
+
+    static Real surfaceArea(const AABB& box) {
+        VEC3F s = box.span();
+        return 2.0 * (s[0] * s[1] + s[1] * s[2] + s[2] * s[0]);
+    }
+
+    static AABB merged(const AABB& a, const AABB& b) {
+        return AABB(a.min().cwiseMin(b.min()), a.max().cwiseMax(b.max()));
+    }
+
+    // Walk down from the root picking whichever child makes the enclosing box
+    // grow the least (surface area heuristic), stopping when descending is no
+    // cheaper than making a new parent right here.
+    int findBestSibling(const AABB& box) const {
+        int index = root;
+        while (!nodes[index].isLeaf()) {
+            const Node& n = nodes[index];
+            Real area         = surfaceArea(n.box);
+            Real combinedArea = surfaceArea(merged(n.box, box));
+
+            Real cost        = 2.0 * combinedArea;
+            Real inheritCost = 2.0 * (combinedArea - area);
+
+            auto childCost = [&](int c) {
+                AABB m = merged(box, nodes[c].box);
+                if (nodes[c].isLeaf()) return surfaceArea(m) + inheritCost;
+                return surfaceArea(m) - surfaceArea(nodes[c].box) + inheritCost;
+            };
+
+            Real costLeft  = childCost(n.left);
+            Real costRight = childCost(n.right);
+
+            if (cost < costLeft && cost < costRight) break;
+
+            index = (costLeft < costRight) ? n.left : n.right;
+        }
+        return index;
+    }
+
+public:
+    // Inserts a box with the given payload; returns the id of the new leaf
+    int insert(const AABB& box, int item) {
+        Node leaf;
+        leaf.box  = box;
+        leaf.item = item;
+        int leafIndex = nodes.size();
+        nodes.push_back(leaf);
+        numLeaves++;
+
+        if (root == -1) {
+            root = leafIndex;
+            return leafIndex;
+        }
+
+        int sibling   = findBestSibling(box);
+        int oldParent = nodes[sibling].parent;
+
+        Node parent;
+        parent.box    = merged(box, nodes[sibling].box);
+        parent.parent = oldParent;
+        parent.left   = sibling;
+        parent.right  = leafIndex;
+        int parentIndex = nodes.size();
+        nodes.push_back(parent);
+
+        nodes[sibling].parent   = parentIndex;
+        nodes[leafIndex].parent = parentIndex;
+
+        if (oldParent == -1) {
+            root = parentIndex;
+        } else if (nodes[oldParent].left == sibling) {
+            nodes[oldParent].left = parentIndex;
+        } else {
+            nodes[oldParent].right = parentIndex;
+        }
+
+        // Refit ancestors
+        for (int i = oldParent; i != -1; i = nodes[i].parent) {
+            nodes[i].box = merged(nodes[nodes[i].left].box, nodes[nodes[i].right].box);
+        }
+
+        return leafIndex;
+    }
+
+    // Calls callback(item) for every leaf whose box overlaps the query box.
+    // The callback returns false to stop the traversal early.
+    template <typename Callback>
+    void query(const AABB& box, Callback callback) const {
+        if (root == -1) return;
+
+        vector<int> stack;
+        stack.push_back(root);
+
+        while (!stack.empty()) {
+            const Node& n = nodes[stack.back()];
+            stack.pop_back();
+
+            if (!n.box.intersects(box)) continue;
+
+            if (n.isLeaf()) {
+                if (!callback(n.item)) return;
+            } else {
+                stack.push_back(n.left);
+                stack.push_back(n.right);
+            }
+        }
+    }
+
+    // Lower bound on the distance from p to anything stored in the tree: the
+    // smallest exterior distance from p to a leaf box (0 if p is inside one)
+    Real minExteriorDistance(const VEC3F& p) const {
+        Real best = numeric_limits<Real>::infinity();
+        if (root == -1) return best;
+
+        vector<int> stack;
+        stack.push_back(root);
+
+        while (!stack.empty()) {
+            const Node& n = nodes[stack.back()];
+            stack.pop_back();
+
+            Real d = n.box.exteriorDistance(p);
+            if (d >= best) continue;
+
+            if (n.isLeaf()) {
+                best = d;
+            } else {
+                stack.push_back(n.left);
+                stack.push_back(n.right);
+            }
+        }
+
+        return best;
+    }
+
+    size_t size() const {
+        return numLeaves;
+    }
+
+    void clear() {
+        nodes.clear();
+        root = -1;
+        numLeaves = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef CONVEX_H
+#define CONVEX_H
+
+#include "SETTINGS.h"
+
+// Boolean Gilbert-Johnson-Keerthi intersection test between two convex shapes,
+// each given by a support function VEC3F support(const VEC3F& dir) returning
+// its furthest point along dir. Works on the Minkowski difference A - B, which
+// contains the origin exactly when the shapes overlap (touching counts).
+namespace GJK
+{
+    static const int MAX_ITERATIONS = 64;
+
+    // The origin counts as on the simplex within EPSILON times the extent of
+    // the Minkowski difference seen so far, so the test doesn't depend on the
+    // units of the shapes
+    static const Real EPSILON = 1e-10;
+
+    // Furthest vertex of a point set along dir
+    inline VEC3F support(const MatrixXd& V, const VEC3F& dir) {
+        Eigen::Index best;
+        (V * dir).maxCoeff(&best);
+        return V.row(best).transpose();
+    }
+
+    // Simplex vertices are stored oldest first, so p[n-1] is always the newest
+    struct Simplex {
+        VEC3F p[4];
+        int n = 0;
+
+        void set(const VEC3F& a) { p[0] = a; n = 1; }
+        void set(const VEC3F& b, const VEC3F& a) { p[0] = b; p[1] = a; n = 2; }
+        void set(const VEC3F& c, const VEC3F& b, const VEC3F& a) { p[0] = c; p[1] = b; p[2] = a; n = 3; }
+    };
+
+    static inline VEC3F tripleCross(const VEC3F& a, const VEC3F& b, const VEC3F& c) {
+        return a.cross(b).cross(c);
+    }
+
+    // Reduces the simplex [b, a] to the feature closest to the origin and
+    // points dir at the origin from it
+    static inline void lineCase(Simplex& s, VEC3F& dir) {
+        const VEC3F a = s.p[1], b = s.p[0];
+        const VEC3F ab = b - a, ao = -a;
+
+        if (ab.dot(ao) > 0) {
+            dir = tripleCross(ab, ao, ab);
+        } else {
+            s.set(a);
+            dir = ao;
+        }
+    }
+
+    static inline void triangleCase(Simplex& s, VEC3F& dir) {
+        const VEC3F a = s.p[2], b = s.p[1], c = s.p[0];
+        const VEC3F ab = b - a, ac = c - a, ao = -a;
+        const VEC3F abc = ab.cross(ac);
+
+        if (abc.cross(ac).dot(ao) > 0) {
+            if (ac.dot(ao) > 0) {
+                s.set(c, a);
+                dir = tripleCross(ac, ao, ac);
+            } else {
+                s.set(b, a);
+                lineCase(s, dir);
+            }
+        } else if (ab.cross(abc).dot(ao) > 0) {
+            s.set(b, a);
+            lineCase(s, dir);
+        } else if (abc.dot(ao) > 0) {
+            dir = abc;
+        } else {
+            s.set(b, c, a);
+            dir = -abc;
+        }
+    }
+
+    // Returns true if the tetrahedron [d, c, b, a] contains the origin,
+    // otherwise reduces it to the face the origin lies beyond
+    static inline bool tetrahedronCase(Simplex& s, VEC3F& dir) {
+        const VEC3F a = s.p[3], b = s.p[2], c = s.p[1], d = s.p[0];
+        const VEC3F ab = b - a, ac = c - a, ad = d - a, ao = -a;
+
+        VEC3F abc = ab.cross(ac);
+        VEC3F acd = ac.cross(ad);
+        VEC3F adb = ad.cross(ab);
+
+        // Make every face normal point away from the opposite vertex
+        if (abc.dot(ad) > 0) abc = -abc;
+        if (acd.dot(ab) > 0) acd = -acd;
+        if (adb.dot(ac) > 0) adb = -adb;
+
+        if (abc.dot(ao) > 0) {
+            s.set(c, b, a);
+            triangleCase(s, dir);
+            return false;
+        }
+        if (acd.dot(ao) > 0) {
+            s.set(d, c, a);
+            triangleCase(s, dir);
+            return false;
+        }
+        if (adb.dot(ao) > 0) {
+            s.set(b, d, a);
+            triangleCase(s, dir);
+            return false;
+        }
+
+        return true;
+    }
+
+    template <typename SupportA, typename SupportB>
+    bool intersects(SupportA supportA, SupportB supportB, VEC3F dir = VEC3F(1, 0, 0)) {
+        auto support = [&](const VEC3F& d) -> VEC3F {
+            return supportA(d) - supportB(-d);
+        };
+
+        if (dir.squaredNorm() == 0) dir = VEC3F(1, 0, 0);
+
+        Simplex s;
+        s.set(support(dir));
+        dir = -s.p[0];
+        Real extent = s.p[0].norm();
+
+        for (int i = 0; i < MAX_ITERATIONS; i++) {
+            // dir is perpendicular to the simplex feature closest to the origin
+            // and scales with powers of its edge lengths, so it's normalised
+            // and the origin's distance to that feature tested instead. The
+            // origin is on the current simplex when that's (near) zero.
+            const Real norm = dir.norm();
+            if (norm == 0) return true;
+            dir /= norm;
+            if (std::abs(s.p[s.n - 1].dot(dir)) <= EPSILON * extent) return true;
+
+            VEC3F a = support(dir);
+            extent = std::max(extent, a.norm());
+
+            // Furthest point towards the origin doesn't reach it: separated
+            if (a.dot(dir) < 0) return false;
+
+            s.p[s.n++] = a;
+
+            switch (s.n) {
+            case 2:
+                lineCase(s, dir);
+                break;
+            case 3:
+                triangleCase(s, dir);
+                break;
+            case 4:
+                if (tetrahedronCase(s, dir)) return true;
+                break;
+            }
+        }
+
+        // Didn't converge, which only happens for (near-)touching shapes
+        // cycling between simplices. Reported as intersecting on purpose: the
+        // callers treat a hit as "don't place or grow the tile here", so a
+        // false positive only costs a little packing density, while a false
+        // negative would let tiles overlap.
+        return true;
+    }
+
+    // Convenience overload for two convex vertex sets
+    inline bool intersects(const MatrixXd& VA, const MatrixXd& VB, const VEC3F& dir = VEC3F(1, 0, 0)) {
+        return intersects(
+            [&](const VEC3F& d) { return support(VA, d); },
+            [&](const VEC3F& d) { return support(VB, d); },
+            dir);
+    }
+}
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef EDT_H
+#define EDT_H
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <igl/parallel_for.h>
+
+#include "SETTINGS.h"
+#include "field.h"
+#include "occupancy.h"
+
+using namespace std;
+
+// Exact Euclidean distance transforms of voxel masks (Felzenszwalb and
+// Huttenlocher): the 1D transform, a lower envelope of parabolas, run along x,
+// then y, then z. Each pass is linear in the number of voxels and its lines are
+// independent, so they're split across threads. Masks and outputs are in
+// ArrayGrid3D storage order, index (z * dims[1] + y) * dims[0] + x, and
+// distances are between voxel centres, spacing apart along each axis.
+namespace EDT
+{
+    // Per-thread buffers of the 1D transform
+    struct edt_internalScratch {
+        vector<Real> line, f, x, bound;
+    };
+
+    // Squared distance transform of the n values d[0], d[stride], ..., in
+    // place: d[p] becomes min over q of d[q] + (spacing * (p - q))^2. Infinite
+    // values are never the minimum, so they're left out of the envelope.
+    static inline void edt_internalLine(Real* d, size_t n, size_t stride, Real spacing, edt_internalScratch& s)
+    {
+        const Real inf = numeric_limits<Real>::infinity();
+
+        // Contiguous copy, so the strided passes touch memory once each way
+        Real* line = s.line.data();
+        for (size_t q = 0; q < n; q++) line[q] = d[q * stride];
+
+        // Parabolas of the envelope (apex x, height f) and where each starts
+        Real* f = s.f.data();
+        Real* x = s.x.data();
+        Real* bound = s.bound.data();
+        int k = -1;
+        for (size_t q = 0; q < n; q++) {
+            if (line[q] == inf) continue;
+
+            const Real fq = line[q], xq = q * spacing;
+            Real cross = -inf;
+            while (k >= 0) {
+                cross = ((fq + xq * xq) - (f[k] + x[k] * x[k])) / (2 * (xq - x[k]));
+                if (cross > bound[k]) break;
+                k--;
+            }
+            k++;
+            f[k] = fq;
+            x[k] = xq;
+            bound[k] = (k == 0) ? -inf : cross;
+        }
+
+        if (k < 0) return; // Nothing finite, all stay infinite
+
+        int j = 0;
+        for (size_t q = 0; q < n; q++) {
+            const Real xq = q * spacing;
+            while (j < k && bound[j + 1] < xq) j++;
+            d[q * stride] = f[j] + (xq - x[j]) * (xq - x[j]);
+        }
+    }
+
+    // Runs the 1D transform over the numLines lines of length n along axis,
+    // line l starting at d + start(l)
+    template <typename Start>
+    static inline void edt_internalPass(Real* d, size_t numLines, size_t n, size_t stride, Real spacing, Start start)
+    {
+        vector<edt_internalScratch> scratch;
+        igl::parallel_for(numLines,
+            [&](size_t numThreads) {
+                scratch.resize(numThreads);
+                for (auto& s : scratch) {
+                    s.line.resize(n);
+                    s.f.resize(n);
+                    s.x.resize(n);
+                    s.bound.resize(n);
+                }
+            },
+            [&](size_t l, size_t t) {
+                edt_internalLine(d + start(l), n, stride, spacing, scratch[t]);
+            },
+            [&](size_t) {}, 1);
+    }
+
+    // Squared distance from each voxel to the nearest voxel with
+    // mask == target (0 on those, infinite if there are none)
+    static inline void squaredDistance(const char* mask, const VEC3I& dims, char target, Real* out, const VEC3F& spacing = VEC3F(1, 1, 1))
+    {
+        const size_t nx = dims[0], ny = dims[1], nz = dims[2];
+        const size_t n = nx * ny * nz;
+        const Real inf = numeric_limits<Real>::infinity();
+
+        for (size_t i = 0; i < n; i++) out[i] = (mask[i] == target) ? 0 : inf;
+
+        // Adjacent lines are adjacent in memory in every pass
+        edt_internalPass(out, ny * nz, nx, 1, spacing[0], [&](size_t l) { return l * nx; });
+        edt_internalPass(out, nx * nz, ny, nx, spacing[1], [&](size_t l) { return (l / nx) * nx * ny + l % nx; });
+        edt_internalPass(out, nx * ny, nz, nx * ny, spacing[2], [&](size_t l) { return l; });
+    }
+
+    // Distance from each voxel to the nearest voxel with mask == target
+    static inline void distance(const char* mask, const VEC3I& dims, char target, Real* out, const VEC3F& spacing = VEC3F(1, 1, 1))
+    {
+        squaredDistance(mask, dims, target, out, spacing);
+
+        const size_t n = (size_t) dims[0] * dims[1] * dims[2];
+        for (size_t i = 0; i < n; i++) out[i] = std::sqrt(out[i]);
+    }
+
+    // Signed distance (negative inside) to the boundary of the set voxels of
+    // mask, taken to be half a voxel out from their centres: the distance to
+    // the nearest voxel of the other kind, less half a voxel. Infinite when
+    // the mask is all set or all unset.
+    static inline void signedDistance(const char* mask, const VEC3I& dims, Real* out, const VEC3F& spacing = VEC3F(1, 1, 1))
+    {
+        const size_t n = (size_t) dims[0] * dims[1] * dims[2];
+        const Real half = 0.5 * spacing.minCoeff();
+
+        vector<Real> toEmpty(n);
+        squaredDistance(mask, dims, 1, out, spacing);
+        squaredDistance(mask, dims, 0, toEmpty.data(), spacing);
+
+        for (size_t i = 0; i < n; i++) {
+            out[i] = mask[i] ? half - std::sqrt(toEmpty[i]) : std::sqrt(out[i]) - half;
+        }
+    }
+
+    // Signed distance of the set voxels of an occupancy volume, over its box
+    // grown by pad voxels on every side, as a grid mapping voxel coordinates
+    // (so the field at voxel p is the node p - volume.origin + pad)
+    static inline ArrayGrid3D* signedDistance(const OccupancyVolume& volume, int pad = 1)
+    {
+        const VEC3I dims = volume.dims + VEC3I(2 * pad, 2 * pad, 2 * pad);
+        const size_t n = (size_t) dims[0] * dims[1] * dims[2];
+
+        vector<char> mask(n, 0);
+        for (int z = 0; z < volume.dims[2]; z++) {
+            for (int y = 0; y < volume.dims[1]; y++) {
+                const uint64_t* words = volume.row(volume.origin[1] + y, volume.origin[2] + z);
+                char* row = &mask[((size_t) (z + pad) * dims[1] + y + pad) * dims[0] + pad];
+                for (int x = 0; x < volume.dims[0]; x++) {
+                    row[x] = (words[x >> 6] >> (x & 63)) & 1;
+                }
+            }
+        }
+
+        ArrayGrid3D* grid = new ArrayGrid3D(dims);
+        signedDistance(mask.data(), dims, &(*grid)[0]);
+
+        const VEC3F lo = (volume.origin - VEC3I(pad, pad, pad)).cast<Real>();
+        grid->setMapBox(AABB(lo, lo + (dims - VEC3I(1, 1, 1)).cast<Real>()));
+        return grid;
+    }
+}
+
+#endif
@@ -1,10 +1,17 @@
 #ifndef FIELD_H
 #define FIELD_H
 
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 #include <queue>
+#include <span>
 
 #include "SETTINGS.h"
 
@@ -126,6 +133,38 @@ public:
         return getFieldValue(pos);
     }
 
+    // Values at the rows of positions (N x 3) into out (N values). Fields
+    // that can do better than one virtual call per point should override this
+    virtual void getFieldValues(const Eigen::MatrixXd& positions, std::span<Real> out) const {
+        for (Eigen::Index i = 0; i < positions.rows(); i++) {
+            out[i] = getFieldValue(positions.row(i).transpose());
+        }
+    }
+
+    // Values at the n points start + i * step (a row of grid nodes), as one
+    // getFieldValues batch
+    virtual void getFieldValuesRow(const VEC3F& start, const VEC3F& step, uint n, Real* out) const {
+        Eigen::MatrixXd positions(n, 3);
+        for (uint i = 0; i < n; i++) {
+            positions.row(i) = (start + i * step).transpose();
+        }
+        getFieldValues(positions, std::span<Real>(out, n));
+    }
+
+    // Whether getFieldValue (or get/getf, for grids) may be called from
+    // several threads at once
+    virtual bool supportsConcurrentReads() const {
+        return true;
+    }
+
+    // Sign of the field over a whole region, if it can be told cheaply: -1 if
+    // negative everywhere in it, 1 if non-negative everywhere, 0 if mixed or
+    // unknown
+    virtual int regionSign(const AABB& region) const {
+        (void) region;
+        return 0;
+    }
+
     virtual VEC3F getNumericalGradient(const VEC3F& pos, Real eps) const {
         Real x = pos[0];
         Real y = pos[1];
@@ -150,6 +189,12 @@ private:
     public:
         VecFieldSubField(VectorField3D* vecField, unsigned index): vecField(vecField), index(index) {}
         virtual Real getFieldValue(const VEC3F& pos) const { return vecField->getFieldValue(pos)[index]; }
+        virtual bool supportsConcurrentReads() const { return vecField->supportsConcurrentReads(); }
+        virtual void getFieldValues(const Eigen::MatrixXd& positions, std::span<Real> out) const {
+            vector<VEC3F> v(positions.rows());
+            vecField->getFieldValues(positions, v);
+            for (size_t i = 0; i < v.size(); i++) out[i] = v[i][index];
+        }
     };
 
     class VecFieldMagField: public FieldFunction3D {
@@ -158,6 +203,12 @@ private:
     public:
         VecFieldMagField(VectorField3D* vecField): vecField(vecField) {}
         virtual Real getFieldValue(const VEC3F& pos) const { return vecField->getFieldValue(pos).norm(); }
+        virtual bool supportsConcurrentReads() const { return vecField->supportsConcurrentReads(); }
+        virtual void getFieldValues(const Eigen::MatrixXd& positions, std::span<Real> out) const {
+            vector<VEC3F> v(positions.rows());
+            vecField->getFieldValues(positions, v);
+            for (size_t i = 0; i < v.size(); i++) out[i] = v[i].norm();
+        }
     };
 
 public:
@@ -210,6 +261,26 @@ public:
         return getFieldValue(pos);
     }
 
+    // As FieldFunction3D::getFieldValues
+    virtual void getFieldValues(const Eigen::MatrixXd& positions, std::span<VEC3F> out) const {
+        for (Eigen::Index i = 0; i < positions.rows(); i++) {
+            out[i] = getFieldValue(positions.row(i).transpose());
+        }
+    }
+
+    // As FieldFunction3D::getFieldValuesRow
+    virtual void getFieldValuesRow(const VEC3F& start, const VEC3F& step, uint n, VEC3F* out) const {
+        Eigen::MatrixXd positions(n, 3);
+        for (uint i = 0; i < n; i++) {
+            positions.row(i) = (start + i * step).transpose();
+        }
+        getFieldValues(positions, std::span<VEC3F>(out, n));
+    }
+
+    virtual bool supportsConcurrentReads() const {
+        return true;
+    }
+
     FieldFunction3D *x, *y, *z, *mag;
 
     virtual void writeCSVPairs(string filename, uint xRes, uint yRes, uint zRes, VEC3F fieldMin, VEC3F fieldMax) {
@@ -325,6 +396,13 @@ public:
         return getFieldValue(pos);
     }
 
+    // As FieldFunction3D::getFieldValues
+    virtual void getFieldValues(const Eigen::MatrixXd& positions, std::span<MAT3F> out) const {
+        for (Eigen::Index i = 0; i < positions.rows(); i++) {
+            out[i] = getFieldValue(positions.row(i).transpose());
+        }
+    }
+
     VectorField3D *x, *y, *z;
     FieldFunction3D *spectralNorm;
 
@@ -344,6 +422,10 @@ public:
         }
         return v;
     }
+
+    virtual bool supportsConcurrentReads() const {
+        return this->field->supportsConcurrentReads();
+    }
 };
 
 class EscapingIteratedVF3D: public VectorField3D {
@@ -365,6 +447,10 @@ public:
         }
         return v;
     }
+
+    virtual bool supportsConcurrentReads() const {
+        return this->field->supportsConcurrentReads();
+    }
 };
 
 class NormalizedVF3D: public VectorField3D {
@@ -376,6 +462,10 @@ public:
     virtual VEC3F getFieldValue(const VEC3F& pos) const {
         return this->field->getFieldValue(pos).normalized();
     }
+
+    virtual bool supportsConcurrentReads() const {
+        return this->field->supportsConcurrentReads();
+    }
 };
 
 class GradientField3D: public VectorField3D {
@@ -388,6 +478,26 @@ public:
     virtual VEC3F getFieldValue(const VEC3F& pos) const {
         return this->field->getNumericalGradient(pos, this->eps);
     }
+
+    // getNumericalGradient of the whole batch, as six batches of the field
+    virtual void getFieldValues(const Eigen::MatrixXd& positions, std::span<VEC3F> out) const {
+        vector<Real> below(positions.rows()), above(positions.rows());
+        for (int c = 0; c < 3; c++) {
+            Eigen::MatrixXd shifted = positions;
+            shifted.col(c).array() -= eps;
+            field->getFieldValues(shifted, below);
+            shifted.col(c) = positions.col(c).array() + eps;
+            field->getFieldValues(shifted, above);
+
+            for (size_t i = 0; i < below.size(); i++) {
+                out[i][c] = (below[i] - above[i]) / (2*eps);
+            }
+        }
+    }
+
+    virtual bool supportsConcurrentReads() const {
+        return this->field->supportsConcurrentReads();
+    }
 };
 
 class JacobianField3D: public MatrixField3D {
@@ -421,6 +531,10 @@ public:
     virtual Real getFieldValue(const VEC3F& pos) const {
         return this->field->getNumericalGradient(pos, this->eps).norm();
     }
+
+    virtual bool supportsConcurrentReads() const {
+        return this->field->supportsConcurrentReads();
+    }
 };
 
 class ConstantFunction3D: public FieldFunction3D {
@@ -433,6 +547,10 @@ public:
         return value;
     }
 
+    virtual void getFieldValues(const Eigen::MatrixXd& positions, std::span<Real> out) const override {
+        std::fill(out.begin(), out.begin() + positions.rows(), value);
+    }
+
 };
 
 class Grid3D: public FieldFunction3D {
@@ -451,6 +569,31 @@ public:
 
     virtual Real get(uint x, uint y, uint z) const = 0;
 
+    // Fills out (xRes * yRes values, x fastest) with the z-th XY plane
+    virtual void getSlice(uint z, Real* out) const {
+        for (uint y = 0; y < yRes; y++) {
+            getRow(y, z, 0, xRes, out + y * xRes);
+        }
+    }
+
+    // Fills out with the nodes x0 <= x < x1 of row (y, z)
+    virtual void getRow(uint y, uint z, uint x0, uint x1, Real* out) const {
+        for (uint x = x0; x < x1; x++) {
+            out[x - x0] = get(x, y, z);
+        }
+    }
+
+    // Sign of every node in the inclusive index range [lo, hi], as for
+    // FieldFunction3D::regionSign: -1, 1, or 0 for mixed or unknown
+    virtual int brickSign(const VEC3I& lo, const VEC3I& hi) const {
+        (void) lo; (void) hi;
+        return 0;
+    }
+
+    // Called before a pass of brickSign queries (e.g. by march_cubes), so
+    // grids can (re)build whatever summary answers them
+    virtual void prepareBrickSigns() {}
+
     virtual Real getf(Real x, Real y, Real z) const {
         (void) x; (void) y; (void) z; // Suppress unused argument warning
         printf("This grid doesn't support non-integer indices!\n");
@@ -476,10 +619,7 @@ public:
             exit(1);
         }
 
-        VEC3F samplePoint = (pos - mapBox.min()).cwiseQuotient(mapBox.span());
-        samplePoint = samplePoint.cwiseMax(VEC3F(0,0,0)).cwiseMin(VEC3F(1,1,1));
-
-        const VEC3F indices = samplePoint.cwiseProduct(VEC3F(xRes-1, yRes-1, zRes-1));
+        const VEC3F indices = fieldToIndices(pos);
 
         if (supportsNonIntegerIndices) {
             return getf(indices);
@@ -488,6 +628,26 @@ public:
         }
     }
 
+    virtual void getFieldValues(const Eigen::MatrixXd& positions, std::span<Real> out) const override {
+        if (!hasMapBox) {
+            printf("Attempting getFieldValues on a Grid3D without a mapBox!\n");
+            exit(1);
+        }
+
+        for (Eigen::Index i = 0; i < positions.rows(); i++) {
+            const VEC3F indices = fieldToIndices(positions.row(i).transpose());
+            out[i] = supportsNonIntegerIndices ? getf(indices) : get(indices.cast<int>());
+        }
+    }
+
+    // Grid indices of a field position, clamped to the grid
+    VEC3F fieldToIndices(const VEC3F& pos) const {
+        VEC3F samplePoint = (pos - mapBox.min()).cwiseQuotient(mapBox.span());
+        samplePoint = samplePoint.cwiseMax(VEC3F(0,0,0)).cwiseMin(VEC3F(1,1,1));
+
+        return samplePoint.cwiseProduct(VEC3F(xRes-1, yRes-1, zRes-1));
+    }
+
     virtual VEC3F gridToFieldCoords(const VEC3F& pos) const {
         if (!hasMapBox) {
             printf("Attempting cellToFieldCoords on a Grid3D without a mapBox!\n");
@@ -647,37 +807,92 @@ public:
         if (totalCells <= 0)
             return;
 
-        // write data
-        for (uint i = 0; i < xRes; ++i) {
-            for (uint j = 0; j < yRes; ++j) {
-                for (uint k = 0; k < zRes; ++k) {
-                    const Real val = get(i, j, k);
-                    double out;
-                    if (sizeof(Real) != sizeof(double)) {
-                        out = (double) val;
-                    } else {
-                        out = val;
-                    }
-
-                    fwrite((void*) (&out), sizeof(double), 1, file);
-
-                }
+        // write data in storage order (x fastest), which is what ArrayGrid3D
+        // reads back, a plane at a time
+        vector<Real> slice((size_t) xRes * yRes);
+        vector<double> out(slice.size());
+        for (uint k = 0; k < zRes; ++k) {
+            getSlice(k, slice.data());
+            for (size_t i = 0; i < slice.size(); i++) {
+                out[i] = (double) slice[i];
             }
+            fwrite((void*) out.data(), sizeof(double), out.size(), file);
 
-            if (verbose && i % 10 == 0) {
-                PB_PROGRESS((Real) i / xRes);
+            if (verbose && k % 10 == 0) {
+                PB_PROGRESS((Real) k / zRes);
             }
         }
 
+        fclose(file);
+
         if (verbose) {
             PB_END();
         }
     }
 };
 
-class ArrayGrid3D: public Grid3D {
+// Samples field at the nodes of an xRes x yRes x zRes grid spanning
+// [functionMin, functionMax] into out, in storage order (x fastest) and a row
+// at a time through field->getFieldValuesRow. The z-slabs are handed out to
+// numThreads threads (0 to use every hardware thread), or to one if the field
+// can't be read concurrently.
+template <typename FieldT, typename T>
+inline void sampleGridNodes(uint xRes, uint yRes, uint zRes, VEC3F functionMin, VEC3F functionMax, const FieldT* field, T* out, const char* what, uint numThreads = 0) {
+    const VEC3F step = (functionMax - functionMin).cwiseQuotient(VEC3F(xRes, yRes, zRes) - VEC3F(1,1,1));
+
+    if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    if (!field->supportsConcurrentReads()) numThreads = 1;
+    numThreads = std::max(1u, std::min(numThreads, zRes));
+
+    // A few slabs per thread, handed out dynamically, to even out load
+    const uint numSlabs = std::min(zRes, numThreads * 4);
+    std::atomic<uint> nextSlab = 0;
+    std::mutex progressMutex;
+    uint slabsDone = 0;
+
+    PB_START("Sampling %dx%dx%d %s on %u threads", xRes, yRes, zRes, what, numThreads);
+    auto startTime = std::chrono::steady_clock::now();
+
+    auto work = [&]() {
+        for (uint s = nextSlab++; s < numSlabs; s = nextSlab++) {
+            uint z0 = (uint64_t) zRes * s / numSlabs;
+            uint z1 = (uint64_t) zRes * (s + 1) / numSlabs;
+            for (uint z = z0; z < z1; z++) {
+                for (uint y = 0; y < yRes; y++) {
+                    VEC3F start = functionMin + VEC3F(0, y * step[1], z * step[2]);
+                    field->getFieldValuesRow(start, VEC3F(step[0], 0, 0), xRes, out + ((size_t) z * yRes + y) * xRes);
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(progressMutex);
+            slabsDone++;
+            PB_PROGRESS((float) slabsDone / numSlabs);
+        }
+    };
+
+    if (numThreads == 1) {
+        work();
+    } else {
+        std::vector<std::thread> workers;
+        for (uint t = 0; t < numThreads; t++) workers.emplace_back(work);
+        for (auto& w : workers) w.join();
+    }
+
+    PB_END();
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    const size_t numSamples = (size_t) xRes * yRes * zRes;
+    PRINTFn("Sampled %zu nodes in %.3fs (%.2fM samples/s)", numSamples, seconds, numSamples / seconds / 1e6);
+}
+
+class ArrayGrid3D final: public Grid3D {
 private:
     Real* values;
+
+    // Brick summary for brickSign, built by prepareBrickSigns
+    static const uint BRICK_SIZE = 8;
+    VEC3I brickRes;
+    vector<Real> brickMin, brickMax;
 public:
 
     // Create empty (not zeroed) field with given resolution
@@ -765,6 +980,54 @@ public:
         return values[(z * yRes + y) * xRes + x];
     }
 
+    // Planes are contiguous in storage
+    void getSlice(uint z, Real* out) const override {
+        memcpy(out, values + (size_t) z * xRes * yRes, sizeof(Real) * xRes * yRes);
+    }
+
+    void getRow(uint y, uint z, uint x0, uint x1, Real* out) const override {
+        memcpy(out, values + ((size_t) z * yRes + y) * xRes + x0, sizeof(Real) * (x1 - x0));
+    }
+
+    // Min/max of each brick of BRICK_SIZE^3 nodes, as of the last call
+    void prepareBrickSigns() override {
+        brickRes = VEC3I((xRes + BRICK_SIZE - 1) / BRICK_SIZE, (yRes + BRICK_SIZE - 1) / BRICK_SIZE, (zRes + BRICK_SIZE - 1) / BRICK_SIZE);
+        brickMin.assign(brickRes.prod(),  numeric_limits<Real>::infinity());
+        brickMax.assign(brickRes.prod(), -numeric_limits<Real>::infinity());
+
+        for (uint z = 0; z < zRes; z++) {
+            for (uint y = 0; y < yRes; y++) {
+                const Real* row = values + ((size_t) z * yRes + y) * xRes;
+                const size_t b0 = ((z / BRICK_SIZE) * brickRes[1] + y / BRICK_SIZE) * brickRes[0];
+                for (uint x = 0; x < xRes; x++) {
+                    const size_t b = b0 + x / BRICK_SIZE;
+                    brickMin[b] = std::min(brickMin[b], row[x]);
+                    brickMax[b] = std::max(brickMax[b], row[x]);
+                }
+            }
+        }
+    }
+
+    // Answered from the bricks overlapping the range, so conservative
+    int brickSign(const VEC3I& lo, const VEC3I& hi) const override {
+        if (brickMin.empty()) return 0;
+
+        Real lowest = numeric_limits<Real>::infinity(), highest = -lowest;
+        for (int bz = lo[2] / BRICK_SIZE; bz <= hi[2] / BRICK_SIZE; bz++) {
+            for (int by = lo[1] / BRICK_SIZE; by <= hi[1] / BRICK_SIZE; by++) {
+                for (int bx = lo[0] / BRICK_SIZE; bx <= hi[0] / BRICK_SIZE; bx++) {
+                    const size_t b = ((size_t) bz * brickRes[1] + by) * brickRes[0] + bx;
+                    lowest  = std::min(lowest, brickMin[b]);
+                    highest = std::max(highest, brickMax[b]);
+                }
+            }
+        }
+
+        if (highest < 0) return -1;
+        if (lowest >= 0) return 1;
+        return 0;
+    }
+
     // Access value directly (allows setting)
     Real& at(uint x, uint y, uint z) {
         return values[(z * yRes + y) * xRes + x];
@@ -798,30 +1061,29 @@ public:
         return values[x];
     }
 
+    // Values in storage order, index (z * yRes + y) * xRes + x
+    const Real* data() const {
+        return values;
+    }
 
-    // Create field from scalar function by sampling it on a regular grid
-    ArrayGrid3D(uint xRes, uint yRes, uint zRes, VEC3F functionMin, VEC3F functionMax, FieldFunction3D *fieldFunction):ArrayGrid3D(xRes, yRes, zRes){
-
-        VEC3F gridResF(xRes, yRes, zRes);
-
-        PB_START("Sampling %dx%dx%d scalar field into ArrayGrid3D", xRes, yRes, zRes);
+    // As Grid3D's, with direct loads in place of virtual gets
+    void getFieldValues(const Eigen::MatrixXd& positions, std::span<Real> out) const override {
+        if (!hasMapBox) {
+            printf("Attempting getFieldValues on a Grid3D without a mapBox!\n");
+            exit(1);
+        }
 
-        for (uint i = 0; i < xRes; i++) {
-            for (uint j = 0; j < yRes; j++) {
-                for (uint k = 0; k < zRes; k++) {
-                    VEC3F gridPointF(i, j, k);
-                    VEC3F fieldDelta = functionMax - functionMin;
+        for (Eigen::Index i = 0; i < positions.rows(); i++) {
+            const VEC3I indices = fieldToIndices(positions.row(i).transpose()).cast<int>();
+            out[i] = values[((size_t) indices[2] * yRes + indices[1]) * xRes + indices[0]];
+        }
+    }
 
-                    VEC3F samplePoint = functionMin + (gridPointF.cwiseQuotient(gridResF - VEC3F(1,1,1)).cwiseProduct(fieldDelta));
 
-                    Real val = fieldFunction->getFieldValue(samplePoint);
+    // Create field from scalar function by sampling it on a regular grid
+    ArrayGrid3D(uint xRes, uint yRes, uint zRes, VEC3F functionMin, VEC3F functionMax, FieldFunction3D *fieldFunction, uint numThreads = 0):ArrayGrid3D(xRes, yRes, zRes){
 
-                    this->at(i, j, k) = val;
-                }
-            }
-            PB_PROGRESS((Real) i / xRes);
-        }
-        PB_END();
+        sampleGridNodes(xRes, yRes, zRes, functionMin, functionMax, fieldFunction, values, "scalar field into ArrayGrid3D", numThreads);
 
         this->setMapBox(AABB(functionMin, functionMax));
 
@@ -888,6 +1150,39 @@ public:
     virtual Real getf(Real x, Real y, Real z) const override {
         return fieldFunction->getFieldValue(getSamplePoint(x, y, z));
     }
+
+    // Samples the function directly, as one batch, skipping the per-node
+    // virtual get
+    virtual void getRow(uint y, uint z, uint x0, uint x1, Real* out) const override {
+        Eigen::MatrixXd positions(x1 - x0, 3);
+        for (uint x = x0; x < x1; x++) {
+            positions.row(x - x0) = getSamplePoint(x, y, z).transpose();
+        }
+        fieldFunction->getFieldValues(positions, std::span<Real>(out, x1 - x0));
+    }
+
+    // The sample points of the whole batch go to the function at once
+    virtual void getFieldValues(const Eigen::MatrixXd& positions, std::span<Real> out) const override {
+        if (!hasMapBox) {
+            printf("Attempting getFieldValues on a Grid3D without a mapBox!\n");
+            exit(1);
+        }
+
+        Eigen::MatrixXd samplePoints(positions.rows(), 3);
+        for (Eigen::Index i = 0; i < positions.rows(); i++) {
+            const VEC3F indices = fieldToIndices(positions.row(i).transpose());
+            samplePoints.row(i) = getSamplePoint(indices[0], indices[1], indices[2]).transpose();
+        }
+        fieldFunction->getFieldValues(samplePoints, out);
+    }
+
+    virtual bool supportsConcurrentReads() const override {
+        return fieldFunction->supportsConcurrentReads();
+    }
+
+    virtual int brickSign(const VEC3I& lo, const VEC3I& hi) const override {
+        return fieldFunction->regionSign(AABB(getSamplePoint(lo[0], lo[1], lo[2]), getSamplePoint(hi[0], hi[1], hi[2])));
+    }
 };
 
 // Hash function for Eigen matrix and vector.
@@ -918,10 +1213,20 @@ public:
 
     using VirtualGrid3D::VirtualGrid3D;
 
+    // Lookups insert into the cache
+    virtual bool supportsConcurrentReads() const override {
+        return false;
+    }
+
     virtual Real get(uint x, uint y, uint z) const override {
         return getf(x,y,z);
     }
 
+    // A point at a time, through the cache
+    virtual void getFieldValues(const Eigen::MatrixXd& positions, std::span<Real> out) const override {
+        Grid3D::getFieldValues(positions, out);
+    }
+
     virtual Real getf(Real x, Real y, Real z) const override {
         VEC3F key(x,y,z);
         numQueries++;
@@ -932,7 +1237,7 @@ public:
             return search->second;
         }
 
-        Real result = VirtualGrid3D::get(x,y,z);
+        Real result = VirtualGrid3D::getf(x,y,z);
         map[key] = result;
         numMisses++;
         return result;
@@ -950,7 +1255,8 @@ public:
     // items are inserted into the cache (beyond the capacity), the cache will
     // forget the item that was least recently inserted. If capacity -1 is
     // specified (default), it defaults to a size equal to three XY slices
-    // through the field, which is suited for marching cubes.
+    // through the field, which is suited for marching cubes. (march_cubes now
+    // reads whole planes through getSlice, so it no longer needs this.)
     VirtualGrid3DLimitedCache(uint xRes, uint yRes, uint zRes, VEC3F functionMin, VEC3F functionMax,  FieldFunction3D *fieldFunction, int capacity = -1):
         VirtualGrid3DCached(xRes, yRes, zRes, functionMin, functionMax, fieldFunction) {
             PRINTV3(functionMin);
@@ -992,7 +1298,7 @@ public:
 };
 
 
-class InterpolationGrid: public Grid3D {
+class InterpolationGrid final: public Grid3D {
 private:
     Real interpolate(Real x0, Real x1, Real d) const {
         switch (mode) {
@@ -1036,6 +1342,26 @@ public:
         return baseGrid->get(x, y, z);
     }
 
+    virtual void getSlice(uint z, Real* out) const override {
+        baseGrid->getSlice(z, out);
+    }
+
+    virtual void getRow(uint y, uint z, uint x0, uint x1, Real* out) const override {
+        baseGrid->getRow(y, z, x0, x1, out);
+    }
+
+    virtual int brickSign(const VEC3I& lo, const VEC3I& hi) const override {
+        return baseGrid->brickSign(lo, hi);
+    }
+
+    virtual void prepareBrickSigns() override {
+        baseGrid->prepareBrickSigns();
+    }
+
+    virtual bool supportsConcurrentReads() const override {
+        return baseGrid->supportsConcurrentReads();
+    }
+
     virtual Real getf(Real x, Real y, Real z) const override {
         // "Trilinear" interpolation with whatever technique we select
 
@@ -1269,27 +1595,10 @@ public:
     // }
 
 
-    // Create field from scalar function by sampling it on a regular grid
-    ArrayVectorGrid3D(uint xRes, uint yRes, uint zRes, VEC3F functionMin, VEC3F functionMax, VectorField3D *fieldFunction):ArrayVectorGrid3D(xRes, yRes, zRes){
+    // Create field from vector function by sampling it on a regular grid
+    ArrayVectorGrid3D(uint xRes, uint yRes, uint zRes, VEC3F functionMin, VEC3F functionMax, VectorField3D *fieldFunction, uint numThreads = 0):ArrayVectorGrid3D(xRes, yRes, zRes){
 
-        VEC3F gridResF(xRes, yRes, zRes);
-
-        PB_START("Sampling %dx%dx%d vector field into ArrayVectorGrid3D...", xRes, yRes, zRes);
-
-        for (uint i = 0; i < xRes; i++) {
-            for (uint j = 0; j < yRes; j++) {
-                for (uint k = 0; k < zRes; k++) {
-                    VEC3F gridPointF(i, j, k);
-                    VEC3F fieldDelta = functionMax - functionMin;
-
-                    VEC3F samplePoint = functionMin + (gridPointF.cwiseQuotient(gridResF - VEC3F(1,1,1)).cwiseProduct(fieldDelta));
-
-                    this->at(i, j, k) = fieldFunction->getFieldValue(samplePoint);
-                }
-            }
-            PB_PROGRESS( ((Real) i)/xRes );
-        }
-        PB_END();
+        sampleGridNodes(xRes, yRes, zRes, functionMin, functionMax, fieldFunction, values, "vector field into ArrayVectorGrid3D", numThreads);
 
         this->setMapBox(AABB(functionMin, functionMax));
 
@@ -0,0 +1,268 @@
+#ifndef FIELDEXPR_H
+#define FIELDEXPR_H
+
+#include <cmath>
+#include <concepts>
+#include <functional>
+#include <span>
+#include <type_traits>
+
+#include "SETTINGS.h"
+#include "field.h"
+
+using namespace std;
+
+// Compile-time field algebra: grids, analytic functions, gradients, norms and
+// arithmetic compose into one value type whose operator()(pos) inlines the
+// whole chain, instead of a chain of heap-allocated fields each behind a
+// virtual call. ExprField3D and ExprVectorField3D wrap an expression back into
+// a FieldFunction3D / VectorField3D, with batch and row evaluation running the
+// fused expression in a tight loop.
+//
+//   auto e = FieldExpr::norm(FieldExpr::gradient(FieldExpr::grid(&sdf), 1e-3));
+//   ExprField3D<decltype(e)> gradNorm(e); // as GradientNormField3D(&sdf, 1e-3)
+namespace FieldExpr
+{
+    // Base of every expression node, so the operators below only pick up
+    // expressions
+    struct Expr {};
+
+    template <typename E>
+    concept IsExpr = std::derived_from<E, Expr>;
+
+    // Exact result types: Eigen vectors claim to convert from scalars
+    template <typename E>
+    concept ScalarExpr = IsExpr<E> && requires(const E& e, const VEC3F& p) { { e(p) } -> std::same_as<Real>; };
+
+    template <typename E>
+    concept VectorExpr = IsExpr<E> && requires(const E& e, const VEC3F& p) { { e(p) } -> std::same_as<VEC3F>; };
+
+    // Eigen results are expression templates over temporaries, so they're
+    // evaluated before being returned
+    template <typename T>
+    static inline auto fe_internalEval(const T& v)
+    {
+        if constexpr (std::is_arithmetic_v<T>) {
+            return (Real) v;
+        } else {
+            return VEC3F(v);
+        }
+    }
+
+    template <typename F>
+    struct Analytic: Expr {
+        F f;
+        Analytic(F f): f(f) {}
+        auto operator()(const VEC3F& pos) const { return fe_internalEval(f(pos)); }
+        bool concurrent() const { return true; }
+    };
+
+    struct Constant: Expr {
+        Real value;
+        Constant(Real value): value(value) {}
+        Real operator()(const VEC3F&) const { return value; }
+        bool concurrent() const { return true; }
+    };
+
+    // Samples a grid through its map box. Grids with their values in storage
+    // order (ArrayGrid3D) are read directly; final grid classes have their
+    // virtual calls resolved at compile time.
+    template <typename GridT>
+    struct GridSample: Expr {
+        const GridT* grid;
+        GridSample(const GridT* grid): grid(grid) {}
+
+        Real operator()(const VEC3F& pos) const {
+            if constexpr (requires { grid->data(); }) {
+                const VEC3I i = grid->fieldToIndices(pos).template cast<int>();
+                return grid->data()[((size_t) i[2] * grid->yRes + i[1]) * grid->xRes + i[0]];
+            } else {
+                return grid->getFieldValue(pos);
+            }
+        }
+
+        bool concurrent() const { return grid->supportsConcurrentReads(); }
+    };
+
+    // Any FieldFunction3D, through its virtual getFieldValue
+    struct Field: Expr {
+        const FieldFunction3D* field;
+        Field(const FieldFunction3D* field): field(field) {}
+        Real operator()(const VEC3F& pos) const { return field->getFieldValue(pos); }
+        bool concurrent() const { return field->supportsConcurrentReads(); }
+    };
+
+    // Central differences with the sign of FieldFunction3D::getNumericalGradient
+    template <ScalarExpr E>
+    struct Gradient: Expr {
+        E e;
+        Real eps;
+        Gradient(E e, Real eps): e(e), eps(eps) {}
+
+        VEC3F operator()(const VEC3F& pos) const {
+            const Real x = pos[0], y = pos[1], z = pos[2];
+            return VEC3F((e(VEC3F(x - eps, y, z)) - e(VEC3F(x + eps, y, z))) / (2*eps),
+                         (e(VEC3F(x, y - eps, z)) - e(VEC3F(x, y + eps, z))) / (2*eps),
+                         (e(VEC3F(x, y, z - eps)) - e(VEC3F(x, y, z + eps))) / (2*eps));
+        }
+
+        bool concurrent() const { return e.concurrent(); }
+    };
+
+    template <VectorExpr E>
+    struct Norm: Expr {
+        E e;
+        Norm(E e): e(e) {}
+        Real operator()(const VEC3F& pos) const { return e(pos).norm(); }
+        bool concurrent() const { return e.concurrent(); }
+    };
+
+    template <VectorExpr E>
+    struct Normalized: Expr {
+        E e;
+        Normalized(E e): e(e) {}
+        VEC3F operator()(const VEC3F& pos) const { return e(pos).normalized(); }
+        bool concurrent() const { return e.concurrent(); }
+    };
+
+    template <VectorExpr E>
+    struct Component: Expr {
+        E e;
+        int index;
+        Component(E e, int index): e(e), index(index) {}
+        Real operator()(const VEC3F& pos) const { return e(pos)[index]; }
+        bool concurrent() const { return e.concurrent(); }
+    };
+
+    // Elementwise arithmetic; Op is one of the std::plus<> family
+    template <IsExpr L, IsExpr R, typename Op>
+    struct Binary: Expr {
+        L l;
+        R r;
+        Binary(L l, R r): l(l), r(r) {}
+        auto operator()(const VEC3F& pos) const { return fe_internalEval(Op()(l(pos), r(pos))); }
+        bool concurrent() const { return l.concurrent() && r.concurrent(); }
+    };
+
+    template <IsExpr E>
+    struct Negate: Expr {
+        E e;
+        Negate(E e): e(e) {}
+        auto operator()(const VEC3F& pos) const { return fe_internalEval(-e(pos)); }
+        bool concurrent() const { return e.concurrent(); }
+    };
+
+    template <typename F>
+    inline Analytic<F> analytic(F f) { return Analytic<F>(f); }
+
+    inline Constant constant(Real value) { return Constant(value); }
+
+    template <typename GridT>
+    inline GridSample<GridT> grid(const GridT* g) { return GridSample<GridT>(g); }
+
+    inline Field field(const FieldFunction3D* f) { return Field(f); }
+
+    template <ScalarExpr E>
+    inline Gradient<E> gradient(E e, Real eps) { return Gradient<E>(e, eps); }
+
+    template <VectorExpr E>
+    inline Norm<E> norm(E e) { return Norm<E>(e); }
+
+    template <VectorExpr E>
+    inline Normalized<E> normalized(E e) { return Normalized<E>(e); }
+
+    template <VectorExpr E>
+    inline Component<E> component(E e, int index) { return Component<E>(e, index); }
+
+    // Plain numbers on either side become constants
+    template <typename T>
+    inline auto fe_internalWrap(T v)
+    {
+        if constexpr (IsExpr<T>) {
+            return v;
+        } else {
+            return Constant(v);
+        }
+    }
+
+    template <typename L, typename R>
+    concept Operands = (IsExpr<L> && (IsExpr<R> || std::is_arithmetic_v<R>)) || (std::is_arithmetic_v<L> && IsExpr<R>);
+
+#define FIELDEXPR_OPERATOR(op, Op) \
+    template <typename L, typename R> requires Operands<L, R> \
+    inline auto operator op(L l, R r) { \
+        auto wl = fe_internalWrap(l); \
+        auto wr = fe_internalWrap(r); \
+        return Binary<decltype(wl), decltype(wr), Op>(wl, wr); \
+    }
+
+    FIELDEXPR_OPERATOR(+, std::plus<>)
+    FIELDEXPR_OPERATOR(-, std::minus<>)
+    FIELDEXPR_OPERATOR(*, std::multiplies<>)
+    FIELDEXPR_OPERATOR(/, std::divides<>)
+
+#undef FIELDEXPR_OPERATOR
+
+    template <IsExpr E>
+    inline Negate<E> operator-(E e) { return Negate<E>(e); }
+}
+
+// A scalar expression as a FieldFunction3D
+template <FieldExpr::ScalarExpr E>
+class ExprField3D: public FieldFunction3D {
+public:
+    E expr;
+
+    ExprField3D(E expr): expr(expr) {}
+
+    virtual Real getFieldValue(const VEC3F& pos) const override {
+        return expr(pos);
+    }
+
+    virtual void getFieldValues(const Eigen::MatrixXd& positions, std::span<Real> out) const override {
+        for (Eigen::Index i = 0; i < positions.rows(); i++) {
+            out[i] = expr(positions.row(i).transpose());
+        }
+    }
+
+    virtual void getFieldValuesRow(const VEC3F& start, const VEC3F& step, uint n, Real* out) const override {
+        for (uint i = 0; i < n; i++) {
+            out[i] = expr(start + i * step);
+        }
+    }
+
+    virtual bool supportsConcurrentReads() const override {
+        return expr.concurrent();
+    }
+};
+
+// A vector expression as a VectorField3D
+template <FieldExpr::VectorExpr E>
+class ExprVectorField3D: public VectorField3D {
+public:
+    E expr;
+
+    ExprVectorField3D(E expr): expr(expr) {}
+
+    virtual VEC3F getFieldValue(const VEC3F& pos) const override {
+        return expr(pos);
+    }
+
+    virtual void getFieldValues(const Eigen::MatrixXd& positions, std::span<VEC3F> out) const override {
+        for (Eigen::Index i = 0; i < positions.rows(); i++) {
+            out[i] = expr(positions.row(i).transpose());
+        }
+    }
+
+    virtual void getFieldValuesRow(const VEC3F& start, const VEC3F& step, uint n, VEC3F* out) const override {
+        for (uint i = 0; i < n; i++) {
+            out[i] = expr(start + i * step);
+        }
+    }
+
+    virtual bool supportsConcurrentReads() const override {
+        return expr.concurrent();
+    }
+};
+
+#endif
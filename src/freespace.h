@@ -0,0 +1,148 @@
+#ifndef FREESPACE_H
+#define FREESPACE_H
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "SETTINGS.h"
+#include "edt.h"
+#include "field.h"
+#include "sdf.h"
+
+using namespace std;
+
+// Voxel occupancy map of the free space inside a target mesh. Free voxels are
+// kept in a dense list (with a back-index for O(1) removal), so a uniformly
+// random free voxel can be drawn in O(1) however full the target gets.
+class FreeSpaceMap {
+public:
+    AABB box;
+    VEC3I dims;
+    VEC3F cellSize;
+
+    // Builds the map with res voxels along the target's longest side; a voxel
+    // starts free when its center is inside the target
+    FreeSpaceMap(const MeshSDF* target, uint res = 64) {
+        box = target->mesh->bbox();
+        Real cell = box.span().maxCoeff() / res;
+
+        for (int c = 0; c < 3; c++) {
+            dims[c] = std::max(1, (int) std::ceil(box.span()[c] / cell));
+        }
+        cellSize = box.span().cwiseQuotient(dims.cast<Real>());
+
+        slot.assign((size_t) dims[0] * dims[1] * dims[2], -1);
+
+        // Voxel centers in id order, classified in one batch
+        Eigen::MatrixXd centers(slot.size(), 3);
+        for (int z = 0; z < dims[2]; z++) {
+            for (int y = 0; y < dims[1]; y++) {
+                for (int x = 0; x < dims[0]; x++) {
+                    centers.row(index(x, y, z)) = cellCenter(x, y, z).transpose();
+                }
+            }
+        }
+
+        Eigen::Array<bool, Eigen::Dynamic, 1> inside;
+        target->containsBatch(centers, inside);
+
+        for (int id = 0; id < (int) slot.size(); id++) {
+            if (inside[id]) {
+                slot[id] = freeCells.size();
+                freeCells.push_back(id);
+            }
+        }
+
+        totalInside = freeCells.size();
+
+        PRINTFn("Free space map: %dx%dx%d voxels, %zu inside the target", dims[0], dims[1], dims[2], totalInside);
+    }
+
+    size_t numFree() const {
+        return freeCells.size();
+    }
+
+    bool empty() const {
+        return freeCells.empty();
+    }
+
+    // Fraction of the target's interior voxels that are still free
+    Real freeFraction() const {
+        return totalInside ? (Real) freeCells.size() / totalInside : 0;
+    }
+
+    // Uniformly random point within a uniformly random free voxel
+    VEC3F sample(std::mt19937& gen) const {
+        std::uniform_int_distribution<size_t> pick(0, freeCells.size() - 1);
+        std::uniform_real_distribution<Real> jitter(0, 1);
+
+        int id = freeCells[pick(gen)];
+        int x = id % dims[0];
+        int y = (id / dims[0]) % dims[1];
+        int z = id / (dims[0] * dims[1]);
+
+        VEC3F offset(x + jitter(gen), y + jitter(gen), z + jitter(gen));
+        return box.min() + offset.cwiseProduct(cellSize);
+    }
+
+    // Marks every free voxel overlapping region whose center satisfies inside(center)
+    template <typename Inside>
+    void carve(const AABB& region, Inside inside) {
+        VEC3I lo, hi;
+        for (int c = 0; c < 3; c++) {
+            lo[c] = std::max(0, (int) std::floor((region.min()[c] - box.min()[c]) / cellSize[c]));
+            hi[c] = std::min(dims[c] - 1, (int) std::floor((region.max()[c] - box.min()[c]) / cellSize[c]));
+        }
+
+        for (int z = lo[2]; z <= hi[2]; z++) {
+            for (int y = lo[1]; y <= hi[1]; y++) {
+                for (int x = lo[0]; x <= hi[0]; x++) {
+                    int id = index(x, y, z);
+                    if (slot[id] != -1 && inside(cellCenter(x, y, z))) {
+                        markOccupied(id);
+                    }
+                }
+            }
+        }
+    }
+
+    // Distance from each voxel center to the nearest voxel center that isn't
+    // free (0 on those), as a grid over the voxel centers; the caller owns it
+    ArrayGrid3D* clearanceGrid() const {
+        vector<char> taken(slot.size());
+        for (size_t id = 0; id < slot.size(); id++) {
+            taken[id] = slot[id] == -1;
+        }
+
+        ArrayGrid3D* grid = new ArrayGrid3D(dims);
+        EDT::distance(taken.data(), dims, 1, &(*grid)[0], cellSize);
+        grid->setMapBox(AABB(cellCenter(0, 0, 0), cellCenter(dims[0] - 1, dims[1] - 1, dims[2] - 1)));
+        return grid;
+    }
+
+private:
+    vector<int> freeCells; // Ids of free voxels, in no particular order
+    vector<int> slot;      // Voxel id -> position in freeCells, -1 if not free
+    size_t totalInside;
+
+    int index(int x, int y, int z) const {
+        return (z * dims[1] + y) * dims[0] + x;
+    }
+
+    VEC3F cellCenter(int x, int y, int z) const {
+        return box.min() + (VEC3F(x, y, z) + VEC3F(0.5, 0.5, 0.5)).cwiseProduct(cellSize);
+    }
+
+    // Swap-with-last removal from freeCells
+    void markOccupied(int id) {
+        int s = slot[id];
+        int last = freeCells.back();
+        freeCells[s] = last;
+        slot[last] = s;
+        freeCells.pop_back();
+        slot[id] = -1;
+    }
+};
+
+#endif
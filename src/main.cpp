@@ -37,26 +37,23 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    cout << "Generating tile..." << endl;
-    // Convert images to sparse matrix
-    VideoTile tile(images);
-    VideoTileOccupancyField occ(&tile);
-
-    VEC3F span = tile.max - tile.min;
+    cout << "Generating hull..." << endl;
+    // Only the hull is kept, so build it straight from the frames' 2D hulls
+    // instead of marching a VideoTile
+    Mesh hull = framesConvexHull(images);
+
+    // Same scaling the marched tile had: 200 units across in x/y, one per frame in z
+    VEC3F lo = hull.V.colwise().minCoeff().transpose();
+    VEC3F span = hull.V.colwise().maxCoeff().transpose() - lo;
     span[2] = 0;
     float scale = 200.0 / span.norm();
-    VEC3F dims = span * scale;
-    dims[2] = (tile.max - tile.min)[2];
-
-    VirtualGrid3D vg(dims[0], dims[1], dims[2], VEC3F(0, 0, 0), VEC3F(1, 1, 1), &occ);
-
-    MCMesh m;
-    MC::march_cubes(&vg, m);
+    hull.V.rowwise() -= lo.transpose();
+    hull.V.leftCols(2) *= scale;
+    hull.invalidateCache();
 
-    m.writeOBJ(outputPath + "_orig.obj");
-    m.convexHull().writeOBJ(outputPath + "_hull.obj");
+    hull.writeOBJ(outputPath + "_hull.obj");
 
-    cout << "Wrote " << outputPath << "_(orig, hull).obj" << endl;
+    cout << "Wrote " << outputPath << "_hull.obj" << endl;
 
     return 0;
 }
@@ -70,13 +67,13 @@ int main(int argc, char* argv[]) {
             tiles.push_back(p);
         }
 
-    MeshPacker mp("./origs_processed/bear.obj", tiles, 0.0005);
+    MeshPacker mp("./origs_processed/bear.obj", tiles, 0.0005, "./origs_processed/bear.sdf.f3d");
     cout << "Created..." << endl;
     mp.pack();
 
     for (int i = 0; i < mp.packed_tiles.size(); ++i) {
-        Mesh m = mp.packed_tiles[i];
-        auto orig_fn = m.filename;
+        const MeshInstance& m = mp.packed_tiles[i];
+        auto orig_fn = m.filename();
         auto bbox = m.bbox();
 
         string ident = orig_fn.substr(orig_fn.find_last_of("/") + 1);
@@ -3,15 +3,18 @@
 #include <fstream>
 #include <iostream>
 #include <cstdio>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "SETTINGS.h"
 #include "field.h"
+#include "convex.h"
 #include "igl/copyleft/cgal/RemeshSelfIntersectionsParam.h"
 
-#include <igl/point_mesh_squared_distance.h>
-#include <igl/winding_number.h>
+#include <igl/AABB.h>
+#include <igl/fast_winding_number.h>
+#include <igl/parallel_for.h>
 #include <igl/volume.h>
 #include <igl/copyleft/cgal/intersect_other.h>
 #include <igl/copyleft/cgal/convex_hull.h>
@@ -25,6 +28,27 @@ public:
 
     string filename;
 
+    // Set when the mesh is known to be convex (e.g. it came out of convexHull),
+    // which lets intersects() use GJK instead of CGAL
+    bool isConvex = false;
+
+    // Call after modifying V or F directly; the transform methods below keep
+    // the cached volume, centroid and bbox up to date on their own
+    void invalidateCache() {
+        volumeValid = centroidValid = bboxValid = false;
+        accel.reset();
+    }
+
+    // Fills the caches and builds the query acceleration structures now.
+    // Const accessors do this lazily, so call it before sharing a mesh
+    // between threads.
+    void cacheDerived() const {
+        meshVolume();
+        getCentroid();
+        bbox();
+        acceleration();
+    }
+
     Mesh(string filename): filename(filename) {
         readOBJ(filename);
     }
@@ -99,6 +123,8 @@ public:
             F.row(i / 3) << indices[i], indices[i + 1], indices[i + 2];
         }
 
+        invalidateCache();
+
         printf("Read %d vertices and %d faces from %s\n", num_vertices(), num_faces(), filename.c_str());
     }
 
@@ -122,14 +148,15 @@ public:
     }
 
     Real distance(const VEC3F& point) const {
-        Eigen::RowVector3d query_point(point.x(), point.y(), point.z());
-        Eigen::VectorXd sqrD;
-        Eigen::VectorXi I;
-        Eigen::MatrixXd C;
+        const Acceleration& a = distanceAcceleration();
+
+        Eigen::RowVector3d query_point = toAccelFrame(point).transpose();
+        Eigen::RowVector3d closest;
+        int face;
 
-        igl::point_mesh_squared_distance(query_point, V, F, sqrD, I, C);
+        Real sqrD = a.tree.squared_distance(a.V, F, query_point, face, closest);
 
-        return std::sqrt(sqrD(0));
+        return std::sqrt(sqrD) * std::abs(accelScale[0]);
     }
 
     Real signedDistance(const VEC3F& point) const {
@@ -139,21 +166,71 @@ public:
         return unsigned_distance * insideFac;
     }
 
+    // Winding numbers are invariant under the scales and translations the
+    // transforms apply, so the build-time structure answers for any of them
     bool contains(const VEC3F& point) const {
-        Eigen::RowVector3d query_point(point.x(), point.y(), point.z());
+        const Acceleration& a = acceleration();
 
-        Real winding_number = igl::winding_number(V, F, query_point);
+        Eigen::RowVector3d query_point = toAccelFrame(point).transpose();
+
+        Real winding_number = igl::fast_winding_number(a.fwn, fwn_accuracy, query_point);
 
         return abs(winding_number) > 0.1;
     }
 
+    // Batched versions of the queries above over the rows of an N x 3 matrix,
+    // spread over threads. The acceleration structures are built up front, so
+    // the per-point queries only read shared state.
+    void containsBatch(const Eigen::MatrixXd& P, Eigen::Array<bool, Eigen::Dynamic, 1>& inside) const {
+        acceleration();
+        inside.resize(P.rows());
+        igl::parallel_for(P.rows(), [&](int i) {
+            inside[i] = contains(P.row(i).transpose());
+        }, batch_grain);
+    }
+
+    void distanceBatch(const Eigen::MatrixXd& P, Eigen::VectorXd& D) const {
+        distanceAcceleration();
+        D.resize(P.rows());
+        igl::parallel_for(P.rows(), [&](int i) {
+            D[i] = distance(P.row(i).transpose());
+        }, batch_grain);
+    }
+
+    void signedDistanceBatch(const Eigen::MatrixXd& P, Eigen::VectorXd& S) const {
+        distanceAcceleration();
+        S.resize(P.rows());
+        igl::parallel_for(P.rows(), [&](int i) {
+            S[i] = signedDistance(P.row(i).transpose());
+        }, batch_grain);
+    }
+
     Mesh convexHull() const {
         Mesh out;
         igl::copyleft::cgal::convex_hull(V, out.V, out.F);
+        out.isConvex = true;
         return out;
     }
 
+    // Checks that every vertex lies on the same side of every face's plane
+    bool checkConvex(Real eps = 1e-6) const {
+        for (int f = 0; f < F.rows(); f++) {
+            VEC3F a = V.row(F(f, 0));
+            VEC3F n = (VEC3F(V.row(F(f, 1))) - a).cross(VEC3F(V.row(F(f, 2))) - a);
+            if (n.norm() == 0) continue;
+            n.normalize();
+
+            Eigen::VectorXd side = (V.rowwise() - a.transpose()) * n;
+            if (side.maxCoeff() > eps && side.minCoeff() < -eps) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     Real meshVolume() const {
+        if (volumeValid) return cachedVolume;
+
         Eigen::MatrixXd V2(V.rows() + 1, V.cols());
         V2.topRows(V.rows()) = V;
         V2.bottomRows(1).setZero();
@@ -165,7 +242,9 @@ public:
         Eigen::VectorXd vol;
         igl::volume(V2, T, vol);
 
-        return std::abs(vol.sum());
+        cachedVolume = std::abs(vol.sum());
+        volumeValid  = true;
+        return cachedVolume;
     }
 
     void scaleMesh(Real factor) {
@@ -179,6 +258,8 @@ public:
 
         // Translate back
         V.rowwise() += centroid.transpose();
+
+        scaleCache(centroid, VEC3F(factor, factor, factor));
     }
 
     void scaleMeshXY(Real factor) {
@@ -193,6 +274,8 @@ public:
 
         // Translate back
         V.rowwise() += centroid.transpose();
+
+        scaleCache(centroid, VEC3F(factor, factor, 1));
     }
 
     void scaleMeshZ(Real factor) {
@@ -206,10 +289,16 @@ public:
 
         // Translate back
         V.rowwise() += centroid.transpose();
+
+        scaleCache(centroid, VEC3F(1, 1, factor));
     }
 
     VEC3F getCentroid() const {
-        return VEC3F(V.col(0).mean(), V.col(1).mean(), V.col(2).mean());
+        if (!centroidValid) {
+            cachedCentroid = VEC3F(V.col(0).mean(), V.col(1).mean(), V.col(2).mean());
+            centroidValid  = true;
+        }
+        return cachedCentroid;
     }
 
     void setCentroid(const VEC3F& newCentroid) {
@@ -217,9 +306,20 @@ public:
         VEC3F translation = newCentroid - currentCentroid;
 
         V.rowwise() += translation.transpose();
+
+        accelOffset += translation;
+        cachedCentroid = newCentroid;
+        if (bboxValid) {
+            cachedBBox.translate(translation);
+        }
     }
 
     bool intersects(const Mesh& other) const {
+        // Both convex: solid overlap test on the vertex sets
+        if (isConvex && other.isConvex) {
+            return GJK::intersects(V, other.V, other.getCentroid() - getCentroid());
+        }
+
         Eigen::MatrixXd IF;
         Eigen::MatrixXd VVAB;
         Eigen::MatrixXi FFAB;
@@ -235,13 +335,203 @@ public:
         return IF.rows() > 0;
     }
 
-    AABB bbox() {
-        AABB out = AABB::insideOut();
-        for (int i = 0; i < V.rows(); i++) {
-            out.include(VEC3F(V(i, 0), V(i, 1), V(i, 2)));
+    AABB bbox() const {
+        if (!bboxValid) {
+            // Eigen asserts on min/max of an empty matrix
+            cachedBBox = (V.rows() == 0) ? AABB::insideOut()
+                                         : AABB(V.colwise().minCoeff().transpose(), V.colwise().maxCoeff().transpose());
+            bboxValid  = true;
+        }
+        return cachedBBox;
+    }
+
+private:
+    // Derived geometry, computed on first use
+    mutable Real  cachedVolume = 0;
+    mutable VEC3F cachedCentroid;
+    mutable AABB  cachedBBox;
+    mutable bool  volumeValid   = false;
+    mutable bool  centroidValid = false;
+    mutable bool  bboxValid     = false;
+
+    // Query structures over the vertices as they were when built, shared by
+    // copies of the mesh. The current vertices are those scaled per axis by
+    // accelScale and then shifted by accelOffset.
+    struct Acceleration {
+        Eigen::MatrixXd V;
+        igl::AABB<Eigen::MatrixXd, 3> tree;
+        igl::FastWindingNumberBVH fwn;
+    };
+    mutable std::shared_ptr<const Acceleration> accel;
+    mutable VEC3F accelScale  = VEC3F(1, 1, 1);
+    mutable VEC3F accelOffset = VEC3F(0, 0, 0);
+
+    // Barnes-Hut accuracy of the fast winding number (libigl's suggested value)
+    static constexpr float fwn_accuracy = 2;
+
+    // Batches smaller than this run on the calling thread
+    static constexpr size_t batch_grain = 1000;
+
+    const Acceleration& acceleration() const {
+        if (!accel) {
+            auto a = std::make_shared<Acceleration>();
+            a->V = V;
+            a->tree.init(a->V, F);
+            igl::fast_winding_number(a->V, F, 2, a->fwn);
+            accel = a;
+            accelScale  = VEC3F(1, 1, 1);
+            accelOffset = VEC3F(0, 0, 0);
+        }
+        return *accel;
+    }
+
+    // Distances only survive uniform scaling of the build-time vertices
+    const Acceleration& distanceAcceleration() const {
+        if (accel && (accelScale.array() != accelScale[0]).any()) {
+            accel.reset();
+        }
+        return acceleration();
+    }
+
+    VEC3F toAccelFrame(const VEC3F& p) const {
+        return (p - accelOffset).cwiseQuotient(accelScale);
+    }
+
+    // Scaling about the centroid keeps it fixed, scales the bbox about it,
+    // multiplies the volume by the product of the factors and composes onto
+    // the acceleration frame
+    void scaleCache(const VEC3F& centroid, const VEC3F& factors) {
+        accelScale  = accelScale.cwiseProduct(factors);
+        accelOffset = (accelOffset - centroid).cwiseProduct(factors) + centroid;
+
+        if (volumeValid) {
+            cachedVolume *= std::abs(factors.prod());
         }
+        if (bboxValid) {
+            cachedBBox = AABB(
+                (cachedBBox.min() - centroid).cwiseProduct(factors) + centroid,
+                (cachedBBox.max() - centroid).cwiseProduct(factors) + centroid);
+        }
+    }
+};
+
+// A catalog mesh placed in the world without copying it: vertices are scaled
+// (per axis) about the catalog mesh's centroid, then moved so that centroid
+// lands on `position`. Vertices are only materialised when a consumer needs
+// an actual vertex matrix (CGAL tests against non-convex meshes, OBJ output).
+class MeshInstance {
+public:
+    const Mesh* base;
+    int catalogId;
+    VEC3F scale;
+    VEC3F position;
+
+    MeshInstance(const Mesh* base, int catalogId, const VEC3F& position):
+        base(base), catalogId(catalogId), scale(1, 1, 1), position(position) {}
+
+    const string& filename() const {
+        return base->filename;
+    }
+
+    bool isConvex() const {
+        return base->isConvex;
+    }
+
+    VEC3F toWorld(const VEC3F& p, const VEC3F& baseCentroid) const {
+        return (p - baseCentroid).cwiseProduct(scale) + position;
+    }
+
+    VEC3F toLocal(const VEC3F& p, const VEC3F& baseCentroid) const {
+        return (p - position).cwiseQuotient(scale) + baseCentroid;
+    }
+
+    void scaleMesh(Real factor) {
+        scale *= factor;
+    }
+
+    void scaleMeshXY(Real factor) {
+        scale[0] *= factor;
+        scale[1] *= factor;
+    }
+
+    void scaleMeshZ(Real factor) {
+        scale[2] *= factor;
+    }
+
+    VEC3F getCentroid() const {
+        return position;
+    }
+
+    void setCentroid(const VEC3F& newCentroid) {
+        position = newCentroid;
+    }
+
+    // Largest XY distance from the centroid to a vertex
+    Real radiusXY() const {
+        VEC3F c = base->getCentroid();
+        Real radius = 0;
+        for (int i = 0; i < base->V.rows(); i++) {
+            radius = std::max(radius, std::hypot((base->V(i, 0) - c[0]) * scale[0], (base->V(i, 1) - c[1]) * scale[1]));
+        }
+        return radius;
+    }
+
+    AABB bbox() const {
+        VEC3F c = base->getCentroid();
+        AABB b = base->bbox();
+        return AABB(toWorld(b.min(), c), toWorld(b.max(), c));
+    }
+
+    Real meshVolume() const {
+        return base->meshVolume() * scale.prod();
+    }
+
+    // Inside/outside is preserved by the transform, so test in catalog space
+    bool contains(const VEC3F& point) const {
+        return base->contains(toLocal(point, base->getCentroid()));
+    }
+
+    // Furthest world-space vertex along dir
+    VEC3F support(const VEC3F& dir) const {
+        return toWorld(GJK::support(base->V, scale.cwiseProduct(dir)), base->getCentroid());
+    }
+
+    bool intersects(const MeshInstance& other) const {
+        if (isConvex() && other.isConvex()) {
+            return GJK::intersects(
+                [&](const VEC3F& d) { return support(d); },
+                [&](const VEC3F& d) { return other.support(d); },
+                other.position - position);
+        }
+
+        return materialize().intersects(other.materialize());
+    }
+
+    bool intersects(const Mesh& other) const {
+        if (isConvex() && other.isConvex) {
+            return GJK::intersects(
+                [&](const VEC3F& d) { return support(d); },
+                [&](const VEC3F& d) { return GJK::support(other.V, d); },
+                other.getCentroid() - position);
+        }
+
+        return materialize().intersects(other);
+    }
+
+    // Builds a standalone mesh with the instance's world-space vertices
+    Mesh materialize() const {
+        Mesh out;
+        VEC3F c = base->getCentroid();
+        out.V = ((base->V.rowwise() - c.transpose()) * scale.asDiagonal()).rowwise() + position.transpose();
+        out.F = base->F;
+        out.filename = base->filename;
+        out.isConvex = base->isConvex;
         return out;
     }
+
+    void writeOBJ(std::string filename) const {
+        materialize().writeOBJ(filename);
+    }
 };
 
 class MCMesh: public Mesh {
@@ -250,22 +540,44 @@ public:
     std::vector<VEC3F> normals;
     std::vector<uint> indices;
 
+    // Whether marching cubes accumulates per-vertex normals (off by default,
+    // nothing in the hull pipeline uses them)
+    bool computeNormals = false;
+
+    // Per-vertex normals, filled in by finalize when computeNormals is set
+    Eigen::MatrixXd N;
+
+    typedef Eigen::Map<const Eigen::Matrix<Real, Eigen::Dynamic, 3, Eigen::RowMajor>> VertexView;
+    typedef Eigen::Map<const Eigen::Matrix<uint, Eigen::Dynamic, 3, Eigen::RowMajor>> FaceView;
+
+    // The buffers viewed as row-major n x 3 matrices, without copying; valid
+    // until the buffers next change
+    VertexView vertexMatrix() const {
+        return VertexView(vertices.empty() ? nullptr : vertices[0].data(), vertices.size(), 3);
+    }
+
+    VertexView normalMatrix() const {
+        return VertexView(normals.empty() ? nullptr : normals[0].data(), normals.size(), 3);
+    }
+
+    FaceView faceMatrix() const {
+        return FaceView(indices.data(), indices.size() / 3, 3);
+    }
+
+    // Copies the buffers into V/F (and N) as one block each and frees them
     void finalize() {
-        V.resize(vertices.size(), 3);
-        F.resize(indices.size() / 3, 3);
+        static_assert(sizeof(VEC3F) == 3 * sizeof(Real), "VEC3F buffers must be packed to view them as matrices");
 
-        for (size_t i = 0; i < vertices.size(); ++i) {
-            V.row(i) << vertices[i].x(), vertices[i].y(), vertices[i].z();
-        }
+        V = vertexMatrix();
+        F = faceMatrix().cast<int>();
+        if (computeNormals) N = normalMatrix();
 
-        for (size_t i = 0; i < indices.size(); i += 3) {
-            F.row(i / 3) << indices[i], indices[i + 1], indices[i + 2];
-        }
+        invalidateCache();
 
-        // Clear temporary vectors to save memory
-        vertices.clear();
-        normals.clear();
-        indices.clear();
+        // Release the buffers; clear() would keep their capacity
+        std::vector<VEC3F>().swap(vertices);
+        std::vector<VEC3F>().swap(normals);
+        std::vector<uint>().swap(indices);
     }
 };
 
@@ -0,0 +1,225 @@
+#ifndef OCCUPANCY_H
+#define OCCUPANCY_H
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+#include "SETTINGS.h"
+
+using namespace std;
+
+// Dense occupancy of a box of voxels, one bit per voxel, with an optional
+// colour per voxel kept in a separate plane. Rows along x are padded to whole
+// 64-bit words, so row scans, counts and bounds work a word at a time.
+class OccupancyVolume {
+public:
+    VEC3I origin; // Coordinates of the first voxel
+    VEC3I dims;
+
+    // Empty box, for growing with include()
+    OccupancyVolume(bool withColors = false): origin(0, 0, 0), dims(0, 0, 0), rowWords(0), withColors(withColors) {}
+
+    OccupancyVolume(const VEC3I& origin, const VEC3I& dims, bool withColors = false): origin(origin), dims(dims), withColors(withColors) {
+        rowWords = (dims[0] + 63) / 64;
+        bits.assign(rowWords * dims[1] * dims[2], 0);
+        if (withColors) {
+            colors.assign((size_t) dims[0] * dims[1] * dims[2], VEC3B(0, 0, 0));
+        }
+    }
+
+    bool hasColors() const {
+        return withColors;
+    }
+
+    // Whether p is inside the box
+    bool inBox(const VEC3I& p) const {
+        VEC3I l = p - origin;
+        return l[0] >= 0 && l[1] >= 0 && l[2] >= 0 && l[0] < dims[0] && l[1] < dims[1] && l[2] < dims[2];
+    }
+
+    bool get(const VEC3I& p) const {
+        if (!inBox(p)) return false;
+        VEC3I l = p - origin;
+        return (bits[wordIndex(l[1], l[2]) + (l[0] >> 6)] >> (l[0] & 63)) & 1;
+    }
+
+    // Sets a voxel inside the box
+    void set(const VEC3I& p) {
+        VEC3I l = p - origin;
+        bits[wordIndex(l[1], l[2]) + (l[0] >> 6)] |= uint64_t(1) << (l[0] & 63);
+    }
+
+    void set(const VEC3I& p, const VEC3B& color) {
+        set(p);
+        if (withColors) {
+            VEC3I l = p - origin;
+            colors[voxelIndex(l[0], l[1], l[2])] = color;
+        }
+    }
+
+    // Colour of a voxel inside the box (black when not stored)
+    VEC3B color(const VEC3I& p) const {
+        if (!withColors) return VEC3B(0, 0, 0);
+        VEC3I l = p - origin;
+        return colors[voxelIndex(l[0], l[1], l[2])];
+    }
+
+    // The words of row (y, z), bit x - origin[0] for voxel x
+    uint64_t* row(int y, int z) {
+        return &bits[wordIndex(y - origin[1], z - origin[2])];
+    }
+
+    const uint64_t* row(int y, int z) const {
+        return &bits[wordIndex(y - origin[1], z - origin[2])];
+    }
+
+    // The colours of row (y, z), or nullptr without a colour plane
+    VEC3B* rowColors(int y, int z) {
+        return withColors ? &colors[voxelIndex(0, y - origin[1], z - origin[2])] : nullptr;
+    }
+
+    size_t wordsPerRow() const {
+        return rowWords;
+    }
+
+    // Grows the box to hold p, at least doubling it along the axes that grow
+    // so that repeated growth is amortized
+    void include(const VEC3I& p) {
+        if (inBox(p)) return;
+
+        VEC3I lo = origin, hi = origin + dims - VEC3I(1, 1, 1);
+        if (bits.empty()) {
+            lo = hi = p;
+        }
+        for (int c = 0; c < 3; c++) {
+            if (p[c] < lo[c]) lo[c] = std::min(p[c], lo[c] - dims[c]);
+            if (p[c] > hi[c]) hi[c] = std::max(p[c], hi[c] + dims[c]);
+        }
+
+        // Frames are outermost, so adding them at the end needs no re-layout
+        if (!bits.empty() && lo == origin && hi.head<2>() == (origin + dims - VEC3I(1, 1, 1)).head<2>()) {
+            resizeFrames(hi[2] - lo[2] + 1);
+            return;
+        }
+
+        OccupancyVolume grown(lo, hi - lo + VEC3I(1, 1, 1), withColors);
+        for (int z = 0; z < dims[2]; z++) {
+            for (int y = 0; y < dims[1]; y++) {
+                const uint64_t* words = &bits[wordIndex(y, z)];
+                for (size_t w = 0; w < rowWords; w++) {
+                    for (uint64_t word = words[w]; word; word &= word - 1) {
+                        int x = w * 64 + countr_zero(word);
+                        VEC3I q = origin + VEC3I(x, y, z);
+                        grown.set(q, color(q));
+                    }
+                }
+            }
+        }
+        *this = std::move(grown);
+    }
+
+    // Sets the number of frames (the z extent), keeping the first ones
+    void resizeFrames(int n) {
+        dims[2] = n;
+        bits.resize(rowWords * dims[1] * n, 0);
+        if (withColors) {
+            colors.resize((size_t) dims[0] * dims[1] * n, VEC3B(0, 0, 0));
+        }
+    }
+
+    // Releases the memory kept after shrinking
+    void shrinkToFit() {
+        bits.shrink_to_fit();
+        colors.shrink_to_fit();
+    }
+
+    size_t count() const {
+        size_t n = 0;
+        for (uint64_t word : bits) n += popcount(word);
+        return n;
+    }
+
+    // Set voxels in frame z
+    size_t count(int z) const {
+        if (z < origin[2] || z >= origin[2] + dims[2]) return 0;
+        size_t n = 0;
+        const uint64_t* words = &bits[wordIndex(0, z - origin[2])];
+        for (size_t w = 0; w < rowWords * dims[1]; w++) n += popcount(words[w]);
+        return n;
+    }
+
+    // Inclusive bounds of the set voxels; false if there are none
+    bool bounds(VEC3I& lo, VEC3I& hi) const {
+        bool found = false;
+        for (int z = 0; z < dims[2]; z++) {
+            for (int y = 0; y < dims[1]; y++) {
+                const uint64_t* words = &bits[wordIndex(y, z)];
+                size_t first = 0, last = rowWords;
+                while (first < rowWords && !words[first]) first++;
+                if (first == rowWords) continue;
+                while (!words[last - 1]) last--;
+
+                VEC3I rlo(first * 64 + countr_zero(words[first]), y, z);
+                VEC3I rhi((last - 1) * 64 + 63 - countl_zero(words[last - 1]), y, z);
+                lo = found ? lo.cwiseMin(rlo) : rlo;
+                hi = found ? hi.cwiseMax(rhi) : rhi;
+                found = true;
+            }
+        }
+        if (found) {
+            lo += origin;
+            hi += origin;
+        }
+        return found;
+    }
+
+    // Whether any voxel in the inclusive range [lo, hi] is set
+    bool any(VEC3I lo, VEC3I hi) const {
+        lo = lo.cwiseMax(origin) - origin;
+        hi = hi.cwiseMin(origin + dims - VEC3I(1, 1, 1)) - origin;
+        if ((lo.array() > hi.array()).any()) return false;
+
+        const size_t w0 = lo[0] >> 6, w1 = hi[0] >> 6;
+        const uint64_t mask0 = ~uint64_t(0) << (lo[0] & 63);
+        const uint64_t mask1 = ~uint64_t(0) >> (63 - (hi[0] & 63));
+
+        for (int z = lo[2]; z <= hi[2]; z++) {
+            for (int y = lo[1]; y <= hi[1]; y++) {
+                const uint64_t* words = &bits[wordIndex(y, z)];
+                if (w0 == w1) {
+                    if (words[w0] & mask0 & mask1) return true;
+                    continue;
+                }
+                if (words[w0] & mask0) return true;
+                for (size_t w = w0 + 1; w < w1; w++) {
+                    if (words[w]) return true;
+                }
+                if (words[w1] & mask1) return true;
+            }
+        }
+        return false;
+    }
+
+    size_t memoryBytes() const {
+        return bits.size() * sizeof(uint64_t) + colors.size() * sizeof(VEC3B);
+    }
+
+private:
+    size_t rowWords;
+    vector<uint64_t> bits;
+    vector<VEC3B> colors;
+    bool withColors;
+
+    // Local (origin-relative) coordinates from here on
+    size_t wordIndex(int y, int z) const {
+        return ((size_t) z * dims[1] + y) * rowWords;
+    }
+
+    size_t voxelIndex(int x, int y, int z) const {
+        return ((size_t) z * dims[1] + y) * dims[0] + x;
+    }
+};
+
+#endif
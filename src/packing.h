@@ -1,29 +1,109 @@
 #ifndef PACKING_H
 #define PACKING_H
 
+#include <atomic>
+#include <cmath>
+#include <optional>
 #include <random>
+#include <thread>
 #include <vector>
 #include <string>
 
 #include "mesh.h"
+#include "bvh.h"
+#include "sdf.h"
+#include "freespace.h"
 
 class MeshPacker {
 public:
     Mesh target_mesh;
+    MeshSDF* target_sdf;
+    FreeSpaceMap* free_space;
     std::vector<Mesh> tile_meshes;
-    std::vector<Mesh> packed_tiles;
+    std::vector<MeshInstance> packed_tiles;
+    Real packed_volume = 0; // Running total of packed_tiles' volumes
     Real min_size_ratio;
 
-    MeshPacker(const std::string& target_obj, const std::vector<std::string>& tile_objs, Real min_size_ratio)
+    // Broad phase over the bounding boxes of packed_tiles, updated on every commit
+    DynamicAABBTree packed_bvh;
+
+    // Collision statistics: exact tile-vs-tile intersection tests, and the
+    // packed tiles the BVH ruled out on checks that found no collision (a
+    // hit ends the traversal early, so those checks have no exact count)
+    std::atomic<long> num_exact_tests  = 0;
+    std::atomic<long> num_bvh_rejected = 0;
+    std::atomic<long> num_clear_checks = 0;
+
+    enum GROWTH_MODE {
+        LINEAR,   // Grow by a fixed factor until the tile collides
+        BISECTION // Bracket the contact scale and bisect it down to growth_tolerance
+    };
+
+    GROWTH_MODE growth_mode = BISECTION;
+
+    // Relative precision of the contact scale found by BISECTION growth
+    Real growth_tolerance = 0.05;
+
+    // Growth statistics: collision checks issued by grow_tile, and how many
+    // the LINEAR schedule would have needed to reach the same scales
+    std::atomic<long> num_growth_checks = 0;
+    std::atomic<long> num_linear_equivalent_checks = 0;
+
+    // XY scale spawn_random_tile leaves a new tile at, and LINEAR's growth rate
+    static constexpr Real spawn_scale = 0.0001;
+    static constexpr Real linear_growth_rate = 0.1;
+
+    // Seeds all random choices made by pack(); fix it for reproducible runs
+    unsigned seed = std::random_device{}();
+
+    // With more than one thread, pack() grows candidates_per_thread tiles per
+    // thread at once against a snapshot of the packing, then commits the ones
+    // that don't conflict with each other and retries the rest. Results depend
+    // only on seed, num_threads and candidates_per_thread.
+    int num_threads = 1;
+    int candidates_per_thread = 2;
+
+    // Parallel packing statistics
+    long num_rounds    = 0;
+    long num_conflicts = 0;
+
+    // Start position statistics: samples drawn and how many were rejected
+    std::atomic<long> num_position_samples = 0;
+    std::atomic<long> num_position_rejections = 0;
+
+    // If sdf_cache is given, the target's signed distance grid is read from
+    // (or, the first time, written to) that F3D file
+    MeshPacker(const std::string& target_obj, const std::vector<std::string>& tile_objs, Real min_size_ratio,
+               const std::string& sdf_cache = "", uint sdf_res = 64, uint free_space_res = 64)
         : min_size_ratio(min_size_ratio) {
             target_mesh = Mesh(target_obj);
+            target_mesh.cacheDerived();
+            target_sdf  = new MeshSDF(&target_mesh, sdf_res, sdf_cache);
+            free_space  = new FreeSpaceMap(target_sdf, free_space_res);
 
             for (const auto& tile_obj : tile_objs) {
                 Mesh m(tile_obj);
+                m.isConvex = m.checkConvex();
+                m.cacheDerived();
                 tile_meshes.push_back(m);
             }
         }
 
+    ~MeshPacker() {
+        delete free_space;
+        delete target_sdf;
+    }
+
+    MeshPacker(const MeshPacker&) = delete;
+    MeshPacker& operator=(const MeshPacker&) = delete;
+
+    enum ATTEMPT_RESULT {
+        COMMITTED, // The tile was packed
+        DISCARDED, // The tile was too small
+        ESCALATED, // Out of tries, zScale was increased
+        FINISHED   // Packing is done
+    };
+
     void pack() {
         Real targetVolume = target_mesh.meshVolume();
         int  numTries = 0;
@@ -32,116 +112,344 @@ public:
 
         PRINTDIV();
         PRINT("Begin packing mesh...");
-        while (true) {
-            auto position = find_random_position();
-            auto tile = spawn_random_tile(position, 1.0 / zScale);
-            Real msr = min_size_ratio;
-
-            grow_tile(tile);
-
-            Real tileVolume = tile.meshVolume();
-
-            if ( tileVolume / targetVolume >= msr) {
-                packed_tiles.push_back(tile);
-                numTries = 0;
-            } else if ( numTries <= 1000 ) { //XXX
-                // If the tile is too small, discard it and try again
-                // unless we've run out of tries
-                numTries += 1;
-                continue;
-            } else if ( zScale >= 3 ) {
-                Real totalVolume = calculate_total_packed_volume();
-                PRINTFn("Terminated. Tiles: %zu. %f volume ratio", packed_tiles.size(), totalVolume / targetVolume);
-                break;
-            } else {
-                zScale  += 1.0;
-                PRINTFn("[i] Increase zScale to %f", zScale);
-                msr /= 2;
-                numTries = 0;
-                continue;
+        if (num_threads > 1) {
+            pack_parallel(targetVolume, numTries, zScale);
+        } else {
+            std::mt19937 gen(seed);
+            while (true) {
+                auto position = find_random_position(gen);
+                auto tile = spawn_random_tile(position, 1.0 / zScale, gen);
+
+                grow_tile(tile);
+
+                if (resolve_attempt(tile, targetVolume, numTries, zScale) == FINISHED) {
+                    break;
+                }
             }
+        }
 
+        print_collision_stats();
+        print_growth_stats();
+    }
 
-            // Check if we've filled the target mesh sufficiently
+    // Applies the acceptance rules to a grown tile, committing it if it's big enough
+    ATTEMPT_RESULT resolve_attempt(const MeshInstance& tile, Real targetVolume, int& numTries, Real& zScale) {
+        Real tileVolume = tile.meshVolume();
+
+        if ( tileVolume / targetVolume >= min_size_ratio) {
+            commit_tile(tile);
+            numTries = 0;
+        } else if ( numTries <= 1000 ) { //XXX
+            // If the tile is too small, discard it and try again
+            // unless we've run out of tries
+            numTries += 1;
+            return DISCARDED;
+        } else if ( zScale >= 3 ) {
             Real totalVolume = calculate_total_packed_volume();
-            PRINTFn("Spawned tile #%zu: %f volume ratio", packed_tiles.size(), totalVolume / targetVolume);
-            if (totalVolume / targetVolume > 0.40) {
-                break;
+            PRINTFn("Terminated. Tiles: %zu. %f volume ratio", packed_tiles.size(), totalVolume / targetVolume);
+            return FINISHED;
+        } else {
+            zScale  += 1.0;
+            PRINTFn("[i] Increase zScale to %f", zScale);
+            numTries = 0;
+            return ESCALATED;
+        }
+
+        // Check if we've filled the target mesh sufficiently
+        Real totalVolume = calculate_total_packed_volume();
+        PRINTFn("Spawned tile #%zu: %f volume ratio", packed_tiles.size(), totalVolume / targetVolume);
+        if (totalVolume / targetVolume > 0.40) {
+            return FINISHED;
+        }
+        return COMMITTED;
+    }
+
+    // Speculative placement: each round grows a batch of candidates in
+    // parallel against the current packing, then resolves them in slot order.
+    // A candidate that overlaps one committed earlier in the same round is
+    // retried (same catalog tile and position) in the next round.
+    void pack_parallel(Real targetVolume, int& numTries, Real& zScale) {
+        struct Retry {
+            int catalogId;
+            VEC3F position;
+        };
+
+        const int numCandidates = num_threads * candidates_per_thread;
+        std::vector<Retry> retries;
+
+        for (bool done = false; !done; num_rounds++) {
+            std::vector<std::optional<MeshInstance>> candidates(numCandidates);
+
+            // Every slot has its own generator, so results don't depend on
+            // which thread picks it up
+            auto growSlot = [&](int k) {
+                std::seed_seq ss{seed, (unsigned) num_rounds, (unsigned) k};
+                std::mt19937 gen(ss);
+
+                if (k < (int) retries.size() && isValidStartingPos(retries[k].position)) {
+                    candidates[k] = spawn_tile(retries[k].catalogId, retries[k].position, 1.0 / zScale);
+                } else {
+                    auto position = find_random_position(gen);
+                    candidates[k] = spawn_random_tile(position, 1.0 / zScale, gen);
+                }
+
+                grow_tile(*candidates[k]);
+            };
+
+            std::vector<std::thread> workers;
+            for (int t = 0; t < num_threads; t++) {
+                workers.emplace_back([&, t]() {
+                    for (int k = t; k < numCandidates; k += num_threads) {
+                        growSlot(k);
+                    }
+                });
+            }
+            for (auto& w : workers) {
+                w.join();
+            }
+
+            retries.clear();
+            size_t roundStart = packed_tiles.size();
+
+            for (int k = 0; k < numCandidates; k++) {
+                const MeshInstance& tile = *candidates[k];
+
+                // Only tiles committed this round weren't in the snapshot
+                bool conflict = false;
+                AABB box = tile.bbox();
+                for (size_t j = roundStart; j < packed_tiles.size() && !conflict; j++) {
+                    conflict = box.intersects(packed_tiles[j].bbox()) && tile.intersects(packed_tiles[j]);
+                }
+
+                if (conflict) {
+                    num_conflicts++;
+                    retries.push_back({tile.catalogId, tile.position});
+                    continue;
+                }
+
+                ATTEMPT_RESULT result = resolve_attempt(tile, targetVolume, numTries, zScale);
+                if (result == FINISHED) {
+                    done = true;
+                    break;
+                }
+                if (result == ESCALATED) {
+                    // The rest of the batch was grown at the old zScale
+                    retries.clear();
+                    break;
+                }
             }
         }
+
+        PRINTFn("Parallel packing: %ld rounds of %d candidates on %d threads, %ld conflicts retried",
+            num_rounds, numCandidates, num_threads, num_conflicts);
     }
 
-    Mesh spawn_random_tile(VEC3F position, Real zScale = 1.0) {
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
+    MeshInstance spawn_random_tile(VEC3F position, Real zScale, std::mt19937& gen) {
         std::uniform_int_distribution<> dis(0, tile_meshes.size() - 1);
+        return spawn_tile(dis(gen), position, zScale);
+    }
 
-        Mesh tile = tile_meshes[dis(gen)];
-        tile.setCentroid(position);
+    MeshInstance spawn_tile(int id, VEC3F position, Real zScale = 1.0) {
+        MeshInstance tile(&tile_meshes[id], id, position);
         tile.scaleMeshZ(zScale);
-        tile.scaleMeshXY(0.0001);
+        tile.scaleMeshXY(spawn_scale);
 
         return tile;
     }
 
-    void grow_tile(Mesh& tile) {
-        Real scale = 1;
+    void grow_tile(MeshInstance& tile) {
+        // Counted per tile, since several threads grow tiles at once
+        long checks = 0;
+        Real scale;
+        if (growth_mode == BISECTION) {
+            scale = grow_tile_bisection(tile, checks);
+        } else {
+            scale = grow_tile_linear(tile, checks);
+        }
+        num_growth_checks += checks;
+
+        // Checks the linear schedule takes to get from spawn_scale to this
+        // scale: one per growth step, plus the colliding one. A tile that
+        // collides straight away ends at spawn_scale / (1 + rate), one check.
+        // The epsilon keeps exact powers of the growth factor from rounding
+        // down.
+        const long linearChecks = 2 + (long) std::floor(std::log(scale / spawn_scale) / std::log(1.0 + linear_growth_rate) + 1e-9);
+        num_linear_equivalent_checks += linearChecks;
+
+        if (growth_mode == LINEAR && checks != linearChecks) {
+            PRINTFn("Linear growth took %ld checks but the linear schedule count is %ld", checks, linearChecks);
+            exit(1);
+        }
+    }
+
+    // Returns the final XY scale of the tile relative to its catalog mesh,
+    // adding the collision checks it took to checks
+    Real grow_tile_linear(MeshInstance& tile, long& checks) {
+        Real scale = spawn_scale;
         int  iters = 0;
-        const Real growth_rate = 0.1;
+        const Real growth_rate = linear_growth_rate;
         while (!check_collision(tile)) {
+            checks++;
             tile.scaleMeshXY(1.0 + growth_rate);
             scale *= (1.0 + growth_rate);
             iters++;
         }
+        checks++;
         // PRINTFn(" -> Collided! (scale: %f, iters: %d, volume ratio: %f)", scale, iters, tile.meshVolume() / target_mesh.meshVolume());
         tile.scaleMeshXY(1.0 / (1.0 + growth_rate)); // Revert the last growth
+        return scale / (1.0 + growth_rate);
+    }
+
+    // Returns the final XY scale of the tile relative to its catalog mesh,
+    // adding the collision checks it took to checks
+    Real grow_tile_bisection(MeshInstance& tile, long& checks) {
+        Real scale = spawn_scale;
+        auto collidesAt = [&](Real s) {
+            tile.scaleMeshXY(s / scale);
+            scale = s;
+            checks++;
+            return check_collision(tile);
+        };
+
+        // Same fallback as the linear schedule when the tile collides straight
+        // away, so this scale is taken to be free without checking it
+        Real lo = spawn_scale / (1.0 + linear_growth_rate);
+        Real hi = -1;
+
+        // Warm start: the scale at which the tile's XY footprint reaches the
+        // nearest obstacle (target surface or packed tile bounding box)
+        VEC3F centroid = tile.getCentroid();
+        Real clearance = std::min(target_sdf->clearance(centroid), packed_bvh.minExteriorDistance(centroid));
+
+        Real radius = tile.radiusXY() / scale;
+
+        Real guess = (radius > 0) ? std::max(spawn_scale, clearance / radius) : spawn_scale;
+
+        // Bracket the contact scale. Most spawns that collide at the guess
+        // collide at spawn_scale too, so check that once instead of halving
+        // all the way down to it.
+        if (collidesAt(guess)) {
+            hi = guess;
+            if (guess > spawn_scale) {
+                if (collidesAt(spawn_scale)) {
+                    hi = spawn_scale;
+                } else {
+                    lo = spawn_scale;
+                }
+            }
+            if (hi == spawn_scale) {
+                tile.scaleMeshXY(lo / scale);
+                return lo;
+            }
+        } else {
+            lo = guess;
+            for (Real s = 2 * lo; hi < 0; s *= 2) {
+                if (collidesAt(s)) {
+                    hi = s;
+                } else {
+                    lo = s;
+                }
+            }
+        }
+
+        // Scales compose multiplicatively, so bisect in log space
+        while (hi / lo > 1.0 + growth_tolerance) {
+            Real mid = std::sqrt(lo * hi);
+            if (collidesAt(mid)) {
+                hi = mid;
+            } else {
+                lo = mid;
+            }
+        }
+
+        tile.scaleMeshXY(lo / scale);
+        return lo;
     }
 
-    bool check_collision(const Mesh& tile) {
+    void print_growth_stats() const {
+        size_t n = std::max((size_t) 1, packed_tiles.size());
+        PRINTFn("Growth checks per committed tile: %.1f (%s), linear schedule would need %.1f",
+            (Real) num_growth_checks.load() / n,
+            (growth_mode == BISECTION) ? "bisection" : "linear",
+            (Real) num_linear_equivalent_checks.load() / n);
+    }
+
+    bool check_collision(const MeshInstance& tile) {
         if (tile.intersects(target_mesh)) {
             return true;
         }
 
-        for (const auto& packed_tile : packed_tiles) {
-            if (tile.intersects(packed_tile)) {
-                return true;
-            }
+        // Only tiles whose boxes overlap the candidate's can possibly intersect it
+        bool hit = false;
+        long tests = 0;
+        packed_bvh.query(tile.bbox(), [&](int i) {
+            tests++;
+            hit = tile.intersects(packed_tiles[i]);
+            return !hit;
+        });
+
+        num_exact_tests += tests;
+        if (!hit) {
+            num_clear_checks++;
+            num_bvh_rejected += (long) packed_tiles.size() - tests;
         }
+        return hit;
+    }
+
+    void commit_tile(const MeshInstance& tile) {
+        packed_tiles.push_back(tile);
+        packed_volume += tile.meshVolume();
+        packed_bvh.insert(tile.bbox(), packed_tiles.size() - 1);
+        free_space->carve(tile.bbox(), [&](const VEC3F& p) { return tile.contains(p); });
+    }
 
-        return false;
+    void print_collision_stats() const {
+        PRINTFn("Exact tile tests: %ld; %ld packed tiles ruled out by the BVH over %ld collision-free checks",
+            num_exact_tests.load(), num_bvh_rejected.load(), num_clear_checks.load());
+        PRINTFn("Target SDF queries: %ld, exact fallbacks near the surface: %ld",
+            target_sdf->numGridQueries.load(), target_sdf->numExactQueries.load());
+        PRINTFn("Start positions: %ld sampled, %ld rejected, %.1f%% of interior voxels still free",
+            num_position_samples.load(), num_position_rejections.load(), 100 * free_space->freeFraction());
     }
 
     bool isValidStartingPos(const VEC3F& pos) {
-        if (!target_mesh.contains(pos)) {
+        if (!target_sdf->contains(pos)) {
             return false;
         }
 
-        for (const auto& packed_tile : packed_tiles) {
-            if (packed_tile.contains(pos)) {
-                return false;
-            }
-        }
+        // Only tiles whose boxes contain the point can contain it
+        bool inside = false;
+        packed_bvh.query(AABB(pos, pos), [&](int i) {
+            inside = packed_tiles[i].contains(pos);
+            return !inside;
+        });
 
-        return true;
+        return !inside;
     }
 
-    VEC3F find_random_position() {
+    // Draws candidates from the free voxels of free_space; a candidate can
+    // still land in a partially covered voxel, so it is checked exactly
+    VEC3F find_random_position(std::mt19937& gen) {
         auto bbox = target_mesh.bbox();
-        VEC3F point;
-
-        do {
-            point = bbox.randomPointInside();
-        } while (!isValidStartingPos(point));
+        std::uniform_real_distribution<Real> u(0, 1);
 
-        return point;
+        while (true) {
+            num_position_samples++;
+            VEC3F point;
+            if (free_space->empty()) {
+                point = bbox.min() + VEC3F(u(gen), u(gen), u(gen)).cwiseProduct(bbox.span());
+            } else {
+                point = free_space->sample(gen);
+            }
+            if (isValidStartingPos(point)) {
+                return point;
+            }
+            num_position_rejections++;
+        }
     }
 
     Real calculate_total_packed_volume() {
-        Real total_volume = 0.0;
-        for (const auto& tile : packed_tiles) {
-            total_volume += tile.meshVolume();
-        }
-        return total_volume;
+        return packed_volume;
     }
 
 };
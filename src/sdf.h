@@ -0,0 +1,201 @@
+#ifndef SDF_H
+#define SDF_H
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <filesystem>
+
+#include "SETTINGS.h"
+#include "field.h"
+#include "mesh.h"
+
+using namespace std;
+
+// Signed distance field of a mesh baked into an ArrayGrid3D (negative inside).
+// Queries read the grid node at or below the query point; since distance is
+// 1-Lipschitz that value is within one cell diagonal of the true distance, so
+// the sign is certain outside that band and the exact mesh is only consulted
+// for points inside it.
+class MeshSDF {
+public:
+    const Mesh* mesh;
+    ArrayGrid3D* grid = nullptr;
+
+    // Maximum error of a grid lookup (one cell diagonal)
+    Real band;
+
+    mutable std::atomic<long> numGridQueries  = 0;
+    mutable std::atomic<long> numExactQueries = 0;
+
+    // Bakes the SDF of the mesh with res cells along its longest side. If
+    // cacheFile is given, the grid is read from it when it exists and written
+    // to it after baking otherwise.
+    MeshSDF(const Mesh* mesh, uint res = 64, string cacheFile = ""): mesh(mesh) {
+        // Pad by a couple of cells so the surface is never on the grid boundary
+        AABB box = mesh->bbox();
+        Real cell = box.span().maxCoeff() / res;
+        VEC3F pad = VEC3F(2, 2, 2) * cell;
+        VEC3F bmin = box.min() - pad;
+        VEC3F bmax = box.max() + pad;
+
+        VEC3I dims;
+        for (int c = 0; c < 3; c++) {
+            dims[c] = (int) std::ceil((bmax[c] - bmin[c]) / cell) + 1;
+            bmax[c] = bmin[c] + (dims[c] - 1) * cell;
+        }
+
+        band = std::sqrt(3.0) * cell;
+
+        // The cache is only used if it was baked from this mesh (per the key
+        // file next to it) over the same box at the same resolution
+        const string key = meshKey();
+        const string keyFile = cacheFile + ".key";
+        if (cacheFile != "" && filesystem::exists(cacheFile)) {
+            string cachedKey;
+            ifstream in(keyFile);
+            getline(in, cachedKey);
+
+            grid = new ArrayGrid3D(cacheFile);
+            const Real tolerance = 1e-3 * cell;
+            if (cachedKey != key) {
+                PRINTFn("SDF cache %s is for a different mesh, rebaking", cacheFile.c_str());
+            } else if (grid->xRes != (uint) dims[0] || grid->yRes != (uint) dims[1] || grid->zRes != (uint) dims[2]) {
+                PRINTFn("SDF cache %s has the wrong resolution, rebaking", cacheFile.c_str());
+            } else if ((grid->mapBox.min() - bmin).cwiseAbs().maxCoeff() > tolerance ||
+                       (grid->mapBox.max() - bmax).cwiseAbs().maxCoeff() > tolerance) {
+                PRINTFn("SDF cache %s has the wrong bounds, rebaking", cacheFile.c_str());
+            } else {
+                PRINTFn("Read %dx%dx%d SDF from %s", dims[0], dims[1], dims[2], cacheFile.c_str());
+                return;
+            }
+            delete grid;
+        }
+
+        bake(dims, bmin, bmax);
+
+        if (cacheFile != "") {
+            grid->writeF3D(cacheFile);
+            ofstream out(keyFile);
+            out << key << "\n";
+            PRINTFn("Wrote SDF cache to %s", cacheFile.c_str());
+        }
+    }
+
+    ~MeshSDF() {
+        delete grid;
+    }
+
+    // Approximate signed distance (within band of the true value)
+    Real approxSignedDistance(const VEC3F& pos) const {
+        return grid->getFieldValue(pos);
+    }
+
+    bool contains(const VEC3F& pos) const {
+        if (!grid->mapBox.contains(pos)) return false;
+
+        numGridQueries++;
+        Real d = approxSignedDistance(pos);
+        if (std::abs(d) > band) return d < 0;
+
+        numExactQueries++;
+        return mesh->contains(pos);
+    }
+
+    // contains() over the rows of P; only the points inside the band go to
+    // the mesh, as one batch
+    void containsBatch(const Eigen::MatrixXd& P, Eigen::Array<bool, Eigen::Dynamic, 1>& inside) const {
+        inside.resize(P.rows());
+
+        std::vector<int> near;
+        long gridQueries = 0;
+        for (int i = 0; i < P.rows(); i++) {
+            VEC3F pos = P.row(i).transpose();
+            inside[i] = false;
+            if (!grid->mapBox.contains(pos)) continue;
+
+            gridQueries++;
+            Real d = approxSignedDistance(pos);
+            if (std::abs(d) > band) {
+                inside[i] = d < 0;
+            } else {
+                near.push_back(i);
+            }
+        }
+
+        numGridQueries  += gridQueries;
+        numExactQueries += near.size();
+
+        Eigen::MatrixXd Q(near.size(), 3);
+        for (size_t j = 0; j < near.size(); j++) {
+            Q.row(j) = P.row(near[j]);
+        }
+
+        Eigen::Array<bool, Eigen::Dynamic, 1> nearInside;
+        mesh->containsBatch(Q, nearInside);
+        for (size_t j = 0; j < near.size(); j++) {
+            inside[near[j]] = nearInside[j];
+        }
+    }
+
+    // Unsigned distance to the surface; exact inside the band, a lower bound
+    // (never more than band below the true value) outside of it
+    Real clearance(const VEC3F& pos) const {
+        if (!grid->mapBox.contains(pos)) return grid->mapBox.exteriorDistance(pos);
+
+        numGridQueries++;
+        Real d = std::abs(approxSignedDistance(pos));
+        if (d > band) return d - band;
+
+        numExactQueries++;
+        return mesh->distance(pos);
+    }
+
+private:
+    // Vertex and face counts and an FNV-1a hash of the vertex and face data
+    string meshKey() const {
+        uint64_t hash = 14695981039346656037ull;
+        auto add = [&](const void* data, size_t bytes) {
+            const unsigned char* p = (const unsigned char*) data;
+            for (size_t i = 0; i < bytes; i++) {
+                hash = (hash ^ p[i]) * 1099511628211ull;
+            }
+        };
+        add(mesh->V.data(), mesh->V.size() * sizeof(double));
+        add(mesh->F.data(), mesh->F.size() * sizeof(int));
+
+        return to_string(mesh->V.rows()) + " " + to_string(mesh->F.rows()) + " " + to_string(hash);
+    }
+
+    void bake(const VEC3I& dims, const VEC3F& bmin, const VEC3F& bmax) {
+        grid = new ArrayGrid3D(dims);
+        grid->setMapBox(AABB(bmin, bmax));
+
+        PRINTFn("Baking %dx%dx%d SDF of %s", dims[0], dims[1], dims[2], mesh->filename.c_str());
+
+        // Grid nodes in storage order, so the result copies straight in
+        const size_t n = (size_t) dims[0] * dims[1] * dims[2];
+        const VEC3F step = (bmax - bmin).cwiseQuotient((dims - VEC3I(1, 1, 1)).cast<Real>());
+        Eigen::MatrixXd P(n, 3);
+        size_t idx = 0;
+        for (int z = 0; z < dims[2]; z++) {
+            for (int y = 0; y < dims[1]; y++) {
+                for (int x = 0; x < dims[0]; x++) {
+                    P.row(idx++) = (bmin + VEC3F(x, y, z).cwiseProduct(step)).transpose();
+                }
+            }
+        }
+
+        Eigen::VectorXd S;
+        mesh->signedDistanceBatch(P, S);
+
+        for (size_t i = 0; i < n; i++) {
+            (*grid)[i] = S(i);
+        }
+    }
+};
+
+#endif
@@ -1,27 +1,102 @@
 #ifndef TILING_H
 #define TILING_H
 
+#include <chrono>
+#include <cstring>
 #include <filesystem>
 #include <limits>
 #include <opencv2/opencv.hpp>
-#include <tuple>
 #include <fstream>
 
+#include <igl/parallel_for.h>
+
+#include "edt.h"
 #include "field.h"
+#include "mesh.h"
+#include "occupancy.h"
 
 using namespace std;
 using namespace cv;
 
 typedef VEC3B Color;
-typedef map<tuple<int, int, int>, Color> VideoMap;
+
+// Packs the non-black test of a row of width C-channel pixels into bits, 64
+// pixels a word. The per-pixel test is branch-free so it vectorises.
+template <int C>
+inline void packNonBlackRow(const uchar* pixels, int width, uint64_t* words) {
+    for (int w = 0; w * 64 < width; w++) {
+        const int n = std::min(64, width - w * 64);
+        const uchar* p = pixels + (size_t) w * 64 * C;
+
+        uchar nonBlack[64] = { 0 };
+        for (int i = 0; i < n; i++) {
+            if constexpr (C == 1) {
+                nonBlack[i] = (p[i] != 0);
+            } else {
+                nonBlack[i] = ((p[i * C] | p[i * C + 1] | p[i * C + 2]) != 0);
+            }
+        }
+
+        // Gathers eight 0/1 bytes into the bits of one byte at a time
+        uint64_t word = 0;
+        for (int b = 0; b < 8; b++) {
+            uint64_t bytes;
+            memcpy(&bytes, nonBlack + 8 * b, 8);
+            word |= ((bytes * 0x0102040810204080ull) >> 56) << (8 * b);
+        }
+        words[w] = word;
+    }
+}
+
+// Frame throughput of a streaming ingest, with decoding and processing timed
+// separately
+struct StreamStats {
+    int frames = 0;
+    double decodeSeconds = 0;
+    double processSeconds = 0;
+
+    double fps() const {
+        double total = decodeSeconds + processSeconds;
+        return total > 0 ? frames / total : 0;
+    }
+
+    void print(const char* what) const {
+        PRINTFn("%s: %d frames in %.2fs, %.1f fps (decoding %.1f fps, processing %.1f fps)", what, frames,
+            decodeSeconds + processSeconds, fps(),
+            decodeSeconds > 0 ? frames / decodeSeconds : 0,
+            processSeconds > 0 ? frames / processSeconds : 0);
+    }
+};
+
+// Reads the frames of capture one at a time, calling process(frame, n) on
+// frame n, so only one decoded frame is held at once
+template <typename ProcessFrame>
+inline StreamStats streamFrames(VideoCapture& capture, ProcessFrame process) {
+    StreamStats stats;
+    Mat frame;
+    while (true) {
+        auto start = chrono::steady_clock::now();
+        bool ok = capture.read(frame);
+        auto decoded = chrono::steady_clock::now();
+        stats.decodeSeconds += chrono::duration<double>(decoded - start).count();
+        if (!ok || frame.empty()) break;
+
+        process(frame, stats.frames);
+        stats.processSeconds += chrono::duration<double>(chrono::steady_clock::now() - decoded).count();
+        stats.frames++;
+    }
+    return stats;
+}
 
 class VideoTile {
 public:
-    VideoMap grid;
+    // Set pixels at (x, y, frame), with their colours unless the tile was
+    // built without them
+    OccupancyVolume volume;
     VEC3F min;
     VEC3F max;
 
-    VideoTile() {
+    VideoTile(bool keepColors = true): volume(keepColors) {
         float fMax = numeric_limits<float>().max();
         float fMin = numeric_limits<float>().lowest();
 
@@ -29,20 +104,24 @@ public:
         this->max = VEC3F(fMin, fMin, fMin);
     }
 
-    static tuple<int, int, int> v3ToTuple(VEC3I v) {
-        return make_tuple(v[0], v[1], v[2]);
+    bool hasPixel(VEC3I coords) const {
+        return volume.get(coords);
     }
 
-    bool hasPixel(VEC3I coords) {
-        return grid.find(v3ToTuple(coords)) != grid.end();
+    // Whether any pixel in the inclusive range [lo, hi] is set
+    bool hasPixelIn(const VEC3I& lo, const VEC3I& hi) const {
+        return volume.any(lo, hi);
     }
 
-    Color getPixel(VEC3I coords) {
-        return grid[v3ToTuple(coords)];
+    // Colour of a set pixel (white if colours aren't kept), black otherwise
+    Color getPixel(VEC3I coords) const {
+        if (!volume.get(coords)) return Color(0, 0, 0);
+        return volume.hasColors() ? volume.color(coords) : Color(255, 255, 255);
     }
 
     void setPixel(VEC3I coords, Color col) {
-        grid[v3ToTuple(coords)] = col;
+        volume.include(coords);
+        volume.set(coords, col);
 
         for (int c = 0; c < 3; c++) {
             if (coords[c] > max[c]) {
@@ -55,19 +134,146 @@ public:
         }
     }
 
-    VideoTile(const vector<Mat>& images): VideoTile() {
-        for (int n = 0; n < images.size(); ++n) {
-            const Mat& img = images[n];
-            for (int y = 0; y < img.rows; ++y) {
-                for (int x = 0; x < img.cols; ++x) {
-                    VEC3B pixel = img.at<VEC3B>(y, x);
-                    if (pixel != VEC3B(0, 0, 0)) {
-                        setPixel(VEC3I(x, y, n), pixel);
+    VideoTile(const vector<Mat>& images, bool keepColors = true): VideoTile(keepColors) {
+        int width = 0, height = 0;
+        for (const Mat& img : images) {
+            width = std::max(width, img.cols);
+            height = std::max(height, img.rows);
+        }
+        volume = OccupancyVolume(VEC3I(0, 0, 0), VEC3I(width, height, images.size()), keepColors);
+
+        ingestFrames(images.size(), [&](int n) { return images[n]; });
+    }
+
+    // Reads the frames from image files, decoding and scanning them on
+    // several threads. Frames are sized to the first one; larger ones are
+    // clipped to it.
+    VideoTile(const vector<string>& paths, bool keepColors = true): VideoTile(keepColors) {
+        if (paths.empty()) return;
+
+        Mat first = imread(paths[0]);
+        if (first.empty()) {
+            PRINTFn("Failed to read frame %s", paths[0].c_str());
+            exit(1);
+        }
+        volume = OccupancyVolume(VEC3I(0, 0, 0), VEC3I(first.cols, first.rows, paths.size()), keepColors);
+
+        ingestFrames(paths.size(), [&](int n) {
+            Mat img = (n == 0) ? first : imread(paths[n]);
+            if (img.empty()) {
+                PRINTFn("Failed to read frame %s, leaving it empty", paths[n].c_str());
+            }
+            return img;
+        });
+    }
+
+    // Streams the frames of a (mask) video into the tile, so memory stays at
+    // one decoded frame plus the volume. The volume is sized from the first
+    // frame; the container's frame count is only an estimate, so it grows
+    // or shrinks to the frames actually read.
+    VideoTile(VideoCapture& capture, bool keepColors = true, StreamStats* stats = nullptr): VideoTile(keepColors) {
+        const int estimate = std::max(1, (int) capture.get(CAP_PROP_FRAME_COUNT));
+
+        StreamStats s = streamFrames(capture, [&](const Mat& frame, int z) {
+            if (z == 0) {
+                volume = OccupancyVolume(VEC3I(0, 0, 0), VEC3I(frame.cols, frame.rows, estimate), keepColors);
+            } else if (z == volume.dims[2]) {
+                volume.resizeFrames(2 * z);
+            }
+
+            VEC3I lo, hi;
+            if (ingestFrame(frame, z, lo, hi)) extendBounds(lo, hi);
+        });
+
+        if (s.frames > 0) {
+            volume.resizeFrames(s.frames);
+            volume.shrinkToFit();
+        }
+
+        s.print("Streamed video tile");
+        if (stats) *stats = s;
+    }
+
+    // Sets frame z from the non-black pixels of img, clipped to the volume
+    // (whose origin must be 0). Returns whether any pixel was set, with
+    // their bounds in lo/hi. Frames touch disjoint rows of the volume, so
+    // different frames can be ingested concurrently.
+    bool ingestFrame(const Mat& img, int z, VEC3I& lo, VEC3I& hi) {
+        const int width = std::min(img.cols, volume.dims[0]);
+        const int height = std::min(img.rows, volume.dims[1]);
+        const int channels = img.channels();
+
+        bool found = false;
+        for (int y = 0; y < height; y++) {
+            const uchar* pixels = img.ptr(y);
+            uint64_t* words = volume.row(y, z);
+
+            switch (channels) {
+            case 1: packNonBlackRow<1>(pixels, width, words); break;
+            case 3: packNonBlackRow<3>(pixels, width, words); break;
+            case 4: packNonBlackRow<4>(pixels, width, words); break;
+            default:
+                PRINTFn("Unsupported frame with %d channels", channels);
+                exit(1);
+            }
+
+            const int numWords = (width + 63) / 64;
+            int first = 0, last = numWords;
+            while (first < numWords && !words[first]) first++;
+            if (first == numWords) continue;
+            while (!words[last - 1]) last--;
+
+            VEC3I rlo(first * 64 + countr_zero(words[first]), y, z);
+            VEC3I rhi((last - 1) * 64 + 63 - countl_zero(words[last - 1]), y, z);
+            lo = found ? lo.cwiseMin(rlo) : rlo;
+            hi = found ? hi.cwiseMax(rhi) : rhi;
+            found = true;
+
+            if (VEC3B* colors = volume.rowColors(y, z)) {
+                for (int w = first; w < last; w++) {
+                    for (uint64_t word = words[w]; word; word &= word - 1) {
+                        const int x = w * 64 + countr_zero(word);
+                        const uchar* p = pixels + x * channels;
+                        colors[x] = (channels == 1) ? Color(p[0], p[0], p[0]) : Color(p[0], p[1], p[2]);
                     }
                 }
             }
         }
+        return found;
     }
+
+    // Grows min/max to hold [lo, hi]
+    void extendBounds(const VEC3I& lo, const VEC3I& hi) {
+        min = min.cwiseMin(lo.cast<Real>());
+        max = max.cwiseMax(hi.cast<Real>());
+    }
+private:
+    // Ingests frames 0..n-1, given by frame(n), in parallel, reducing the
+    // per-thread pixel bounds into min/max at the end
+    template <typename FrameFunction>
+    void ingestFrames(int n, FrameFunction frame) {
+        vector<VEC3I> los, his;
+        vector<char> founds;
+        igl::parallel_for(n,
+            [&](size_t numThreads) {
+                los.resize(numThreads);
+                his.resize(numThreads);
+                founds.assign(numThreads, false);
+            },
+            [&](int z, size_t t) {
+                VEC3I lo, hi;
+                if (ingestFrame(frame(z), z, lo, hi)) {
+                    los[t] = founds[t] ? los[t].cwiseMin(lo) : lo;
+                    his[t] = founds[t] ? his[t].cwiseMax(hi) : hi;
+                    founds[t] = true;
+                }
+            },
+            [&](size_t t) {
+                if (founds[t]) extendBounds(los[t], his[t]);
+            }, 1);
+    }
+
+public:
     void writeToVTK(const string& filename) {
         ofstream file(filename);
         if (!file.is_open()) {
@@ -139,6 +345,8 @@ public:
         cout << dims[0] << " " << dims[1] << " " << dims[2] << endl;
         cout << origin << endl;
 
+        volume = OccupancyVolume(origin.cast<int>(), VEC3I(dims[0], dims[1], dims[2]), volume.hasColors());
+
         // Read color data
         for (int z = 0; z < dims[2]; ++z) {
             for (int y = 0; y < dims[1]; ++y) {
@@ -201,8 +409,238 @@ public:
         return (tile->hasPixel(pi)) ? -1 : 1;
     }
 
+    // A point at a time, without the virtual call
+    virtual void getFieldValues(const Eigen::MatrixXd& positions, std::span<Real> out) const override {
+        for (Eigen::Index i = 0; i < positions.rows(); i++) {
+            out[i] = VideoTileOccupancyField::getFieldValue(positions.row(i).transpose());
+        }
+    }
+
+    // Positive wherever the region holds no pixels. Truncation to pixels is
+    // monotonic, so the corners bound the pixels.
+    virtual int regionSign(const AABB& region) const override {
+        VEC3F lo = tile->min + region.min().cwiseProduct(tile->max - tile->min);
+        VEC3F hi = tile->min + region.max().cwiseProduct(tile->max - tile->min);
+        VEC3I loi(lo[0], lo[1], lo[2]);
+        VEC3I hii(hi[0], hi[1], hi[2]);
+
+        return tile->hasPixelIn(loi, hii) ? 0 : 1;
+    }
+
+};
+
+// VideoTileOccupancyField sampled from a flat array over the tile's bounds,
+// padded by PAD empty voxels so face pixels see empty space, with the index
+// strides precomputed. In OCCUPANCY mode the values are -1 on pixels and 1
+// elsewhere, as VideoTileOccupancyField's; in DISTANCE mode
+// they're the signed distance (in pixels, negative inside) to the boundary of
+// the pixels, computed once up front and interpolated trilinearly, so the
+// surface marching cubes finds by root finding is smooth.
+class VideoTileDenseField: public FieldFunction3D {
+public:
+    enum FIELD_MODE {
+        OCCUPANCY,
+        DISTANCE
+    };
+
+    const VideoTile* tile;
+    FIELD_MODE mode;
+
+    VideoTileDenseField(const VideoTile* tile, FIELD_MODE mode = OCCUPANCY): tile(tile), mode(mode) {
+        origin = tile->min;
+        span = tile->max - tile->min;
+        for (int c = 0; c < 3; c++) dims[c] = (int) span[c] + 1 + 2 * PAD;
+        strides = VEC3I(1, dims[0], dims[0] * dims[1]);
+
+        // The padding stays empty, so pixels on the faces of the bounds see
+        // the space outside them
+        const size_t n = (size_t) dims[0] * dims[1] * dims[2];
+        vector<char> occupied(n, 0);
+        for (int z = PAD; z < dims[2] - PAD; z++) {
+            for (int y = PAD; y < dims[1] - PAD; y++) {
+                for (int x = PAD; x < dims[0] - PAD; x++) {
+                    VEC3I p = VEC3I(x - PAD, y - PAD, z - PAD) + origin.cast<int>();
+                    occupied[index(x, y, z)] = tile->hasPixel(p);
+                }
+            }
+        }
+
+        values.resize(n);
+        if (mode == OCCUPANCY) {
+            for (size_t i = 0; i < n; i++) values[i] = occupied[i] ? -1 : 1;
+        } else {
+            EDT::signedDistance(occupied.data(), dims, values.data());
+
+            // Without any pixels the distances are infinite; no distance
+            // in the box exceeds its diagonal, so that bound interpolates
+            const Real bound = dims.cast<Real>().norm();
+            for (size_t i = 0; i < n; i++) values[i] = std::min(values[i], bound);
+        }
+    }
+
+    virtual Real getFieldValue(const VEC3F& pos) const override {
+        if (mode == OCCUPANCY) {
+            VEC3F p = origin + pos.cwiseProduct(span);
+            VEC3I pi = VEC3I(p[0], p[1], p[2]) - origin.cast<int>() + VEC3I(PAD, PAD, PAD);
+            if ((pi.array() < 0).any() || (pi.array() >= dims.array()).any()) return 1;
+            return values[pi.dot(strides)];
+        }
+
+        // Trilinear interpolation between voxel centres, clamped to the box
+        VEC3F q = (pos.cwiseProduct(span) + VEC3F(PAD, PAD, PAD)).cwiseMax(VEC3F(0, 0, 0)).cwiseMin((dims - VEC3I(1, 1, 1)).cast<Real>());
+        VEC3I i0, step;
+        VEC3F t;
+        for (int c = 0; c < 3; c++) {
+            i0[c] = std::min((int) q[c], dims[c] - 1);
+            t[c] = q[c] - i0[c];
+            step[c] = (i0[c] + 1 < dims[c]) ? strides[c] : 0;
+        }
+
+        const Real* v = &values[i0.dot(strides)];
+        Real c00 = v[0]                  * (1 - t[0]) + v[step[0]]                  * t[0];
+        Real c10 = v[step[1]]            * (1 - t[0]) + v[step[1] + step[0]]        * t[0];
+        Real c01 = v[step[2]]            * (1 - t[0]) + v[step[2] + step[0]]        * t[0];
+        Real c11 = v[step[2] + step[1]]  * (1 - t[0]) + v[step[2] + step[1] + step[0]] * t[0];
+        Real c0 = c00 * (1 - t[1]) + c10 * t[1];
+        Real c1 = c01 * (1 - t[1]) + c11 * t[1];
+        return c0 * (1 - t[2]) + c1 * t[2];
+    }
+
+    // A point at a time, without the virtual call
+    virtual void getFieldValues(const Eigen::MatrixXd& positions, std::span<Real> out) const override {
+        for (Eigen::Index i = 0; i < positions.rows(); i++) {
+            out[i] = VideoTileDenseField::getFieldValue(positions.row(i).transpose());
+        }
+    }
+
+    // As VideoTileOccupancyField's; interpolation reaches one voxel further
+    // in DISTANCE mode
+    virtual int regionSign(const AABB& region) const override {
+        VEC3F lo = origin + region.min().cwiseProduct(span);
+        VEC3F hi = origin + region.max().cwiseProduct(span);
+        VEC3I loi(lo[0], lo[1], lo[2]);
+        VEC3I hii(hi[0], hi[1], hi[2]);
+        if (mode == DISTANCE) hii += VEC3I(1, 1, 1);
+
+        return tile->hasPixelIn(loi, hii) ? 0 : 1;
+    }
+
+private:
+    static const int PAD = 1;
+
+    VEC3F origin, span;
+    VEC3I dims, strides;
+    vector<Real> values;
+
+    size_t index(int x, int y, int z) const {
+        return (size_t) x * strides[0] + (size_t) y * strides[1] + (size_t) z * strides[2];
+    }
 };
 
+// Mask of the pixels of a frame VideoTile would set: non-black in the first
+// three channels (alpha is ignored), as in packNonBlackRow
+inline Mat nonBlackMask(const Mat& img) {
+    const int channels = img.channels();
+    if (channels != 1 && channels != 3 && channels != 4) {
+        PRINTFn("Unsupported frame with %d channels", channels);
+        exit(1);
+    }
+
+    Mat mask(img.rows, img.cols, CV_8UC1);
+    for (int y = 0; y < img.rows; y++) {
+        const uchar* p = img.ptr(y);
+        uchar* m = mask.ptr(y);
+        for (int x = 0; x < img.cols; x++) {
+            const uchar v = (channels == 1) ? p[x] : (p[x * channels] | p[x * channels + 1] | p[x * channels + 2]);
+            m[x] = v ? 255 : 0;
+        }
+    }
+    return mask;
+}
+
+// 2D convex hull of the non-black pixels of a frame (empty if there are none)
+inline vector<Point> frameConvexHull(const Mat& img) {
+    Mat mask = nonBlackMask(img);
+
+    // The outer contours hold every extreme pixel, in far fewer points
+    vector<vector<Point>> contours;
+    findContours(mask, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+
+    vector<Point> points, hull;
+    for (const auto& contour : contours) {
+        points.insert(points.end(), contour.begin(), contour.end());
+    }
+    if (!points.empty()) {
+        convexHull(points, hull);
+    }
+    return hull;
+}
+
+// 3D convex hull of per-frame 2D hulls stacked with frame n at z = n, in the
+// same (x, y, frame) coordinates as VideoTile. Empty frames contribute
+// nothing; with no pixels at all the mesh is empty, and with pixels in a
+// single frame the hull is flat: that frame's hull polygon, fan triangulated
+// (no faces if it's a point or a segment).
+inline Mesh liftFrameHulls(const vector<vector<Point>>& hulls) {
+    size_t n = 0, frames = 0, last = 0;
+    for (size_t z = 0; z < hulls.size(); z++) {
+        if (hulls[z].empty()) continue;
+        n += hulls[z].size();
+        frames++;
+        last = z;
+    }
+
+    Mesh points;
+    if (frames == 0) return points;
+
+    points.V.resize(n, 3);
+    size_t row = 0;
+    for (size_t z = 0; z < hulls.size(); z++) {
+        for (const Point& p : hulls[z]) {
+            points.V.row(row++) << p.x, p.y, z;
+        }
+    }
+
+    if (frames == 1) {
+        // Coplanar points: the 2D hull is already in order around the polygon
+        const int m = hulls[last].size();
+        points.F.resize(std::max(0, m - 2), 3);
+        for (int i = 1; i + 1 < m; i++) {
+            points.F.row(i - 1) << 0, i, i + 1;
+        }
+        points.isConvex = true;
+        return points;
+    }
+
+    return points.convexHull();
+}
+
+// Convex hull of the tile VideoTile(images) would hold, without building it:
+// the hull of the voxels is the hull of each frame's 2D hull lifted to its
+// frame, so only those few points go into the 3D hull
+inline Mesh framesConvexHull(const vector<Mat>& images) {
+    vector<vector<Point>> hulls(images.size());
+    igl::parallel_for(images.size(), [&](int n) {
+        hulls[n] = frameConvexHull(images[n]);
+    }, 1);
+
+    return liftFrameHulls(hulls);
+}
+
+// framesConvexHull of the frames of a (mask) video, streamed one at a time,
+// so only the per-frame 2D hulls are kept
+inline Mesh videoConvexHull(VideoCapture& capture, StreamStats* stats = nullptr) {
+    vector<vector<Point>> hulls;
+    StreamStats s = streamFrames(capture, [&](const Mat& frame, int) {
+        hulls.push_back(frameConvexHull(frame));
+    });
+
+    s.print("Streamed video hull");
+    if (stats) *stats = s;
+
+    return liftFrameHulls(hulls);
+}
+
 
 #endif
 